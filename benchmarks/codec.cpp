@@ -0,0 +1,128 @@
+// Compares encode/decode cost of the JSON and protobuf codecs on a typical publish command
+// and publication push.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "protocol_all.h"
+#include "protocol_protobuf.h"
+
+using namespace centrifugo;
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr auto ITERATIONS = 200'000;
+
+volatile std::size_t sink = 0;
+
+template<typename F>
+auto measure(char const *name, F &&func) -> void
+{
+    for (auto i = 0; i < ITERATIONS / 10; ++i) { // warm up
+        func();
+    }
+
+    auto const start = Clock::now();
+    for (auto i = 0; i < ITERATIONS; ++i) {
+        func();
+    }
+    auto const elapsed = std::chrono::duration<double, std::nano> {Clock::now() - start};
+    std::printf("%-32s %10.1f ns/op\n", name, elapsed.count() / ITERATIONS);
+}
+
+auto payload() -> json
+{
+    return {{"game", "pinball"},
+            {"machine", 1042},
+            {"scores", {1250000, 830000, 4125000, 0}},
+            {"player", 3},
+            {"ball", 2},
+            {"active", true}};
+}
+
+auto publicationJson() -> std::string
+{
+    return json {{"push",
+                  {{"channel", "scoreboard:1042"},
+                   {"pub",
+                    {{"offset", 12345},
+                     {"data", payload()},
+                     {"info", {{"user", "42"}, {"client", "0b5e3c59"}}},
+                     {"tags", {{"source", "machine"}}}}}}}}
+            .dump();
+}
+
+auto publicationProtobuf() -> std::string
+{
+    auto const data = payload().dump();
+    auto out = std::string {};
+    auto w = protobuf::Writer {out};
+    w.message(4, [&](protobuf::Writer &push) {
+        push.bytes(2, "scoreboard:1042");
+        push.message(4, [&](protobuf::Writer &pub) {
+            pub.bytes(4, data);
+            pub.message(5, [](protobuf::Writer &info) {
+                info.bytes(1, "42");
+                info.bytes(2, "0b5e3c59");
+            });
+            pub.uint(6, 12345);
+            pub.message(7, [](protobuf::Writer &tag) {
+                tag.bytes(1, "source");
+                tag.bytes(2, "machine");
+            });
+        });
+    });
+    return out;
+}
+
+}
+
+int main()
+{
+    auto const data = payload();
+    auto const cmd = Command {7, PublishRequest {"scoreboard:1042", &data, {}}};
+
+    std::printf("-- encode publish command\n");
+    measure("json (DOM)", [&] { sink = sink + json(cmd).dump().size(); });
+    measure("json", [&] {
+        auto out = std::string {};
+        encodeJson(cmd, out);
+        sink = sink + out.size();
+    });
+    measure("protobuf", [&] {
+        auto out = std::string {};
+        protobuf::encode(cmd, out);
+        sink = sink + out.size();
+    });
+
+    auto rawReq = PublishRequest {};
+    rawReq.channel = "scoreboard:1042";
+    rawReq.raw = RawJson {payload().dump()};
+    auto const rawCmd = Command {7, rawReq};
+    measure("json (raw payload)", [&] {
+        auto out = std::string {};
+        encodeJson(rawCmd, out);
+        sink = sink + out.size();
+    });
+
+    auto const jsonPub = publicationJson();
+    auto const protobufPub = publicationProtobuf();
+
+    std::printf("-- decode publication push (%zu vs %zu bytes)\n", jsonPub.size(),
+                protobufPub.size());
+    measure("json", [&] { sink = sink + decodeReply(jsonPub).result.index(); });
+    measure("json (lazy payload)",
+            [&] { sink = sink + decodeReply(jsonPub, true).result.index(); });
+    auto const dom = json::parse(jsonPub);
+    measure("json (parsed DOM to Reply)", [&] { sink = sink + dom.get<Reply>().result.index(); });
+    measure("protobuf", [&] { sink = sink + protobuf::decode(protobufPub).result.index(); });
+    measure("protobuf (lazy payload)",
+            [&] { sink = sink + protobuf::decode(protobufPub, true).result.index(); });
+
+    return 0;
+}
@@ -0,0 +1,154 @@
+// Shows the CPU and bytes trade-off of permessage-deflate settings (see DeflateConfig) on a
+// stream of scoreboard publications, each differing from the previous one in a few fields.
+// Compression runs the way permessage-deflate does: every message is sync flushed and the
+// trailing 00 00 ff ff is stripped; without context takeover the stream is reset in between.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/beast/zlib.hpp>
+#include <nlohmann/json.hpp>
+
+namespace zlib = boost::beast::zlib;
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr auto MESSAGES = 2'000;
+constexpr auto ROUNDS = 10;
+
+struct Setting {
+    char const *name;
+    int level;
+    int windowBits;
+    int memLevel;
+    bool noContextTakeover;
+};
+
+auto publications() -> std::vector<std::string>
+{
+    auto rng = std::mt19937 {42};
+    auto score = std::uniform_int_distribution<int> {0, 5'000'000};
+    auto pick = std::uniform_int_distribution<int> {0, 3};
+
+    auto scores = json::array({1250000, 830000, 4125000, 0});
+    auto messages = std::vector<std::string> {};
+    messages.reserve(MESSAGES);
+    for (auto i = 0; i < MESSAGES; ++i) {
+        scores[pick(rng)] = score(rng);
+        messages.push_back(json {{"push",
+                                  {{"channel", "scoreboard:1042"},
+                                   {"pub",
+                                    {{"offset", 12345 + i},
+                                     {"data",
+                                      {{"game", "pinball"},
+                                       {"machine", 1042},
+                                       {"scores", scores},
+                                       {"player", 1 + i % 4},
+                                       {"ball", 1 + i / 4 % 3},
+                                       {"active", true}}},
+                                     {"info", {{"user", "42"}, {"client", "0b5e3c59"}}}}}}}}
+                                   .dump());
+    }
+    return messages;
+}
+
+auto elapsed(Clock::time_point start) -> double
+{
+    return std::chrono::duration<double, std::nano> {Clock::now() - start}.count();
+}
+
+auto run(Setting const &setting, std::vector<std::string> const &messages) -> void
+{
+    auto deflater = zlib::deflate_stream {};
+    auto inflater = zlib::inflate_stream {};
+    auto compressed = std::vector<std::string> {};
+    auto out = std::vector<char> {};
+    auto ec = boost::system::error_code {};
+
+    auto inputBytes = std::size_t {0};
+    auto outputBytes = std::size_t {0};
+    auto const deflateStart = Clock::now();
+    for (auto round = 0; round < ROUNDS; ++round) {
+        deflater.reset(setting.level, setting.windowBits, setting.memLevel, zlib::Strategy::normal);
+        compressed.clear();
+        for (auto const &message : messages) {
+            out.resize(message.size() + 64);
+            auto zs = zlib::z_params {};
+            zs.next_in = message.data();
+            zs.avail_in = message.size();
+            zs.next_out = out.data();
+            zs.avail_out = out.size();
+            deflater.write(zs, zlib::Flush::sync, ec);
+            compressed.emplace_back(out.data(), zs.total_out - 4); // 00 00 ff ff
+            if (setting.noContextTakeover) {
+                deflater.reset();
+            }
+            inputBytes += message.size();
+            outputBytes += compressed.back().size();
+        }
+    }
+    auto const deflateNs = elapsed(deflateStart);
+
+    static constexpr char TAIL[] = {'\x00', '\x00', '\xff', '\xff'};
+    auto const inflateStart = Clock::now();
+    for (auto round = 0; round < ROUNDS; ++round) {
+        inflater.reset(setting.windowBits);
+        for (auto i = std::size_t {0}; i < compressed.size(); ++i) {
+            out.resize(messages[i].size() + 64);
+            auto zs = zlib::z_params {};
+            zs.next_out = out.data();
+            zs.avail_out = out.size();
+            for (auto const &in : {std::string_view {compressed[i]}, std::string_view {TAIL, 4}}) {
+                zs.next_in = in.data();
+                zs.avail_in = in.size();
+                inflater.write(zs, zlib::Flush::sync, ec);
+            }
+            if (setting.noContextTakeover) {
+                inflater.reset();
+            }
+        }
+    }
+    auto const inflateNs = elapsed(inflateStart);
+
+    auto const count = double {MESSAGES * ROUNDS};
+    std::printf("%-28s %8.1f %8.1f%% %10.1f %10.1f\n", setting.name, outputBytes / count,
+                100.0 * outputBytes / inputBytes, deflateNs / count, inflateNs / count);
+}
+
+}
+
+int main()
+{
+    auto const messages = publications();
+
+    auto bytes = std::size_t {0};
+    for (auto const &message : messages) {
+        bytes += message.size();
+    }
+
+    std::printf("%-28s %8s %9s %10s %10s\n", "setting", "bytes", "ratio", "deflate ns",
+                "inflate ns");
+    std::printf("%-28s %8.1f %8.1f%% %10s %10s\n", "uncompressed", double(bytes) / MESSAGES,
+                100.0, "-", "-");
+
+    auto const settings = {
+            Setting {"default (level 8, 15 bits)", 8, 15, 4, false},
+            Setting {"level 1", 1, 15, 4, false},
+            Setting {"level 6", 6, 15, 4, false},
+            Setting {"level 9, memory 9", 9, 15, 9, false},
+            Setting {"window 9 bits", 8, 9, 4, false},
+            Setting {"window 11 bits, memory 1", 8, 11, 1, false},
+            Setting {"no context takeover", 8, 15, 4, true},
+            Setting {"no context takeover, lvl 1", 1, 15, 4, true},
+    };
+    for (auto const &setting : settings) {
+        run(setting, messages);
+    }
+
+    return 0;
+}
@@ -0,0 +1,156 @@
+// Counts heap allocations per queued command on the write path: commands are encoded into the
+// pending frame, tracked until their reply and the frame buffers are swapped on every write,
+// the way Transport does it. A steady-state publisher should report 0 allocs/op.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/strand.hpp>
+#include <nlohmann/json.hpp>
+
+#include "inflight_commands.h"
+#include "protocol_all.h"
+#include "protocol_protobuf.h"
+#include "timer_wheel.h"
+
+using namespace centrifugo;
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr auto ITERATIONS = 200'000;
+constexpr auto MESSAGES_PER_FRAME = 16;
+// Replies arrive this many commands after their request
+constexpr auto REPLY_LAG = 64u;
+
+std::size_t allocations = 0;
+
+}
+
+auto operator new(std::size_t size) -> void *
+{
+    ++allocations;
+    if (auto *ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc {};
+}
+
+auto operator delete(void *ptr) noexcept -> void
+{
+    std::free(ptr);
+}
+
+auto operator delete(void *ptr, std::size_t) noexcept -> void
+{
+    std::free(ptr);
+}
+
+namespace {
+
+// Frame buffers and in-flight tracking of one transport
+class WritePath
+{
+public:
+    explicit WritePath(boost::asio::strand<boost::asio::io_context::executor_type> const &strand)
+        : timers_ {strand}
+    {
+    }
+
+    template<typename Encode>
+    auto queue(Command &cmd, Encode &&encode) -> void
+    {
+        cmd.id = ++lastId_;
+        encode(cmd, pending_);
+
+        auto entry = InFlightCommands::Entry {};
+        entry.id = cmd.id;
+        entry.queuedAt = InFlightCommands::Clock::now();
+        entry.deadline = timers_.schedule(std::chrono::seconds {5}, [this, id = cmd.id] {
+            inFlight_.complete(id);
+        });
+        inFlight_.add(entry);
+
+        if (cmd.id > REPLY_LAG) {
+            if (auto const replied = inFlight_.complete(cmd.id - REPLY_LAG)) {
+                timers_.cancel(replied->deadline);
+            }
+        }
+        if (cmd.id % MESSAGES_PER_FRAME == 0) {
+            writing_.clear();
+            std::swap(writing_, pending_);
+        }
+    }
+
+private:
+    TimerWheel timers_;
+    InFlightCommands inFlight_;
+    std::string pending_;
+    std::string writing_;
+    std::uint32_t lastId_ {0};
+};
+
+template<typename F>
+auto measure(char const *name, F &&func) -> void
+{
+    for (auto i = 0; i < ITERATIONS / 10; ++i) { // warm up
+        func();
+    }
+
+    auto const before = allocations;
+    auto const start = Clock::now();
+    for (auto i = 0; i < ITERATIONS; ++i) {
+        func();
+    }
+    auto const elapsed = std::chrono::duration<double, std::nano> {Clock::now() - start};
+    std::printf("%-24s %10.1f ns/op %8.2f allocs/op\n", name, elapsed.count() / ITERATIONS,
+                static_cast<double>(allocations - before) / ITERATIONS);
+}
+
+auto payload() -> json
+{
+    return {{"game", "pinball"},
+            {"machine", 1042},
+            {"scores", {1250000, 830000, 4125000, 0}},
+            {"player", 3},
+            {"ball", 2},
+            {"active", true}};
+}
+
+auto encodeJsonLine(Command const &cmd, std::string &out) -> void
+{
+    if (!out.empty()) {
+        out += '\n';
+    }
+    encodeJson(cmd, out);
+}
+
+}
+
+int main()
+{
+    auto io = boost::asio::io_context {};
+    auto const strand = boost::asio::make_strand(io);
+
+    auto const data = payload();
+    auto cmd = Command {0, PublishRequest {"scoreboard:1042", &data, {}}};
+    auto rawReq = PublishRequest {};
+    rawReq.channel = "scoreboard:1042";
+    rawReq.raw = RawJson {payload().dump()};
+    auto rawCmd = Command {0, rawReq};
+
+    std::printf("-- queue publish command\n");
+    auto jsonPath = WritePath {strand};
+    measure("json", [&] { jsonPath.queue(cmd, encodeJsonLine); });
+    auto rawPath = WritePath {strand};
+    measure("json (raw payload)", [&] { rawPath.queue(rawCmd, encodeJsonLine); });
+    auto protobufPath = WritePath {strand};
+    measure("protobuf", [&] { protobufPath.queue(cmd, protobuf::encode); });
+
+    return 0;
+}
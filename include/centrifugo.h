@@ -1,6 +1,7 @@
 #pragma once
 
 #include <optional>
+#include <vector>
 
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/strand.hpp>
@@ -25,17 +26,32 @@ public:
     ~Client();
 
     auto state() const -> ConnectionState;
+    // Counted since the client was created, on its strand like the rest of its state
+    auto writeStats() const -> WriteStats;
 
     auto connect() -> outcome::result<void, Error>;
     auto disconnect() -> void;
 
     auto publish(std::string const &channel, nlohmann::json const &data)
             -> outcome::result<void, Error>;
+    auto publish(std::string const &channel, RawJson const &data) -> outcome::result<void, Error>;
+
+    // Publishes data to every channel, serializing it only once. All publish commands go out in
+    // the same frame, results are in the order of channels.
+    auto publishMany(std::vector<std::string> const &channels, nlohmann::json const &data)
+            -> std::vector<outcome::result<void, Error>>;
+    auto publishMany(std::vector<std::string> const &channels, RawJson const &data)
+            -> std::vector<outcome::result<void, Error>>;
 
     auto send(nlohmann::json const &data) -> outcome::result<void, Error>;
 
-    auto newSubscription(std::string const &channel)
+    auto newSubscription(std::string const &channel, SubscriptionOptions const &options = {})
             -> outcome::result<std::reference_wrapper<Subscription>, std::string>;
+    // Creates and subscribes a subscription for every channel, results are in the order of
+    // channels. Subscribe commands are paced by ClientConfig::subscribePacing.
+    auto subscribeMany(std::vector<std::string> const &channels,
+                       SubscriptionOptions const &options = {})
+            -> std::vector<outcome::result<SubscriptionRef, std::string>>;
     auto removeSubscription(SubscriptionRef const &sub) -> void;
     auto subscription(std::string const &channel) const -> std::optional<SubscriptionRef>;
     auto subscriptions() const -> std::unordered_map<std::string, SubscriptionRef>;
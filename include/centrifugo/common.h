@@ -1,5 +1,8 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <functional>
 
@@ -18,6 +21,105 @@ struct LogEntry {
     nlohmann::json fields;
 };
 
+// Wire format used to talk to the server
+enum class Protocol { Json, Protobuf };
+
+// WebSocket permessage-deflate (RFC 7692) offered to the server, defaults are Beast's
+struct DeflateConfig {
+    bool enabled {false};
+    // LZ77 window sizes offered for each direction, 9..15 (zlib can't do 8)
+    int serverMaxWindowBits {15};
+    int clientMaxWindowBits {15};
+    // Reset the compression context after every message, trades ratio for memory
+    bool serverNoContextTakeover {false};
+    bool clientNoContextTakeover {false};
+    // zlib compression level 0..9 and memory level 1..9 of outgoing messages
+    int compressionLevel {8};
+    int memoryLevel {4};
+    // Outgoing messages smaller than this are sent uncompressed. Needs Boost 1.81 or later,
+    // older versions compress every message.
+    std::size_t messageSizeThreshold {0};
+};
+
+// How long to wait for the reply to each kind of command, zero waits forever. A command
+// without reply in time fails with ErrorType::Timeout, a connect one also reconnects.
+struct CommandTimeouts {
+    std::chrono::milliseconds connect {5000};
+    std::chrono::milliseconds subscribe {5000};
+    std::chrono::milliseconds unsubscribe {5000};
+    std::chrono::milliseconds publish {5000};
+    std::chrono::milliseconds refresh {5000};
+};
+
+// How queued commands are grouped into WebSocket frames. By default everything queued during
+// one event loop turn, or while the previous frame is being written, goes out in one frame.
+struct WriteBatching {
+    // Caps of one frame, zero means no cap. A single message larger than maxBytes is still sent.
+    std::size_t maxBytes {0};
+    std::uint32_t maxMessages {0};
+    // Wait this long after the first queued message for more to join its frame, unless a cap is
+    // reached first. Zero flushes on the next event loop turn.
+    std::chrono::microseconds linger {0};
+    // Double the caps, up to 16 times, for each frame that leaves a backlog behind and go back
+    // to them once it drains. Keeps frames small while idle and large under load.
+    bool adaptive {false};
+};
+
+// What a publish does when the outbound queue is at OutboundQueue::maxBytes
+enum class OverflowPolicy {
+    // The publish fails with ErrorType::QueueFull
+    Reject,
+    // Unsent publishes are dropped oldest first to make room, each fails with ErrorType::QueueFull
+    DropOldest,
+    // The publish is held back and queued in order as the queue drains, publish() succeeds.
+    // At most another maxBytes are held back, past that publishes fail with QueueFull. One
+    // which expires or fails to serialize while held back is reported through onError().
+    Wait,
+};
+
+// Bounds of the commands queued but not yet written to the socket. Only publishes are held to
+// them, control commands always get through.
+struct OutboundQueue {
+    // Zero leaves the queue unbounded. The publish crossing the bound is still queued.
+    std::size_t maxBytes {0};
+    OverflowPolicy overflow {OverflowPolicy::Reject};
+    // onHighWatermark is called once the queue grows past highWatermark bytes, onLowWatermark
+    // when it is back at lowWatermark with nothing held back. A zero highWatermark disables them.
+    std::size_t highWatermark {0};
+    std::size_t lowWatermark {0};
+    std::function<void()> onHighWatermark;
+    std::function<void()> onLowWatermark;
+    // Publishes still unsent after this long are dropped and fail with ErrorType::Timeout,
+    // zero keeps them until they are sent
+    std::chrono::milliseconds publishTtl {0};
+};
+
+// Paces subscribe commands, after a reconnect every subscription subscribes again at once and
+// thousands of them trip the server's command rate limits. A zero batchSize sends them
+// unpaced.
+struct SubscribePacing {
+    std::size_t batchSize {0};
+    std::chrono::milliseconds interval {100};
+};
+
+// Time messages of one lane waited between being queued and their frame being written
+struct QueueDelay {
+    std::uint64_t messages {0};
+    std::chrono::nanoseconds total {0};
+    std::chrono::nanoseconds max {0};
+};
+
+// Counters of the write path, messages / frames tells how well commands are coalesced
+struct WriteStats {
+    std::uint64_t frames {0};
+    std::uint64_t messages {0};
+    std::uint32_t lastFrameMessages {0};
+    // Connect, subscribe, unsubscribe, refresh and pongs
+    QueueDelay control;
+    // Publish and send
+    QueueDelay data;
+};
+
 struct ClientConfig {
     std::string token;
     std::function<outcome::result<std::string>()> getToken;
@@ -29,6 +131,40 @@ struct ClientConfig {
     std::chrono::milliseconds minReconnectDelay {200};
     std::chrono::milliseconds maxReconnectDelay {20000};
 
+    // Protobuf sends binary WebSocket frames, connects with ?format=protobuf
+    Protocol protocol {Protocol::Json};
+
+    // Keep publication payloads as raw bytes (Publication::rawData) and parse them only when
+    // Publication::payload() is called. Handlers that forward bytes never build a DOM.
+    bool lazyPublicationData {false};
+
+    DeflateConfig deflate {};
+    CommandTimeouts commandTimeouts {};
+    WriteBatching batching {};
+    OutboundQueue outbound {};
+    SubscribePacing subscribePacing {};
+
+    // Put subscriptions waiting to subscribe into the connect command, saving a round trip.
+    // Channels the server doesn't answer for in the connect result subscribe as usual, and
+    // after a failed connect they aren't included again.
+    bool subscribeInConnect {false};
+
+    // Messages of a received frame and recovered publications handled per turn of the event
+    // loop, the rest is resumed in a later turn so timers and writes get to run in between.
+    // 0 handles everything at once.
+    std::size_t workBudget {0};
+
+    // Threads which parse publication payloads and run onPublication callbacks, so the strand
+    // only frames and routes messages. A channel sticks to one of them, which keeps its
+    // publications in order. 0 does everything on the strand.
+    // Callbacks then run on several threads at once, one per channel at a time. A callback
+    // replaced with Client::onPublication() gets the publications handled from then on, ones
+    // already handed to a worker still go to the callback they were handed with.
+    std::size_t dispatchWorkers {0};
+
+    // Check that RawJson payloads parse before publishing them
+    bool validateRawJson {false};
+
     std::function<void(LogEntry)> logHandler;
 };
 
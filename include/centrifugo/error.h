@@ -19,9 +19,16 @@ enum class ErrorType {
 
     Unauthorized,
     NoPing,
+    InvalidJson,
+    InvalidDelta,
+    Timeout,
+    QueueFull,
+    PublicationsLost,
 
+    UnknownChannel = 102,
     PermissionDenied = 103,
     AlreadySubscribed = 105,
+    BadCommand = 107,
     TokenExpired = 109,
 
     Shutdown = 3001,
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <nlohmann/json.hpp>
 
@@ -11,11 +16,61 @@ struct ClientInfo {
     std::string client;
 };
 
+// Mutex which copies and moves as a fresh one, so structs holding it stay copyable
+class CopyableMutex
+{
+public:
+    CopyableMutex() = default;
+    CopyableMutex(CopyableMutex const &) {}
+    auto operator=(CopyableMutex const &) -> CopyableMutex & { return *this; }
+
+    auto lock() -> void { mutex_.lock(); }
+    auto unlock() -> void { mutex_.unlock(); }
+
+private:
+    std::mutex mutex_;
+};
+
 struct Publication {
     std::uint64_t offset {0};
-    nlohmann::json data;
+    // With ClientConfig::lazyPublicationData it stays null until payload() is called
+    mutable nlohmann::json data;
     std::optional<ClientInfo> info;
     std::unordered_map<std::string, std::string> tags;
+    // Serialized payload as received, set with ClientConfig::lazyPublicationData. Protobuf
+    // clients also keep it while delta subscriptions exist, data is then parsed on delivery.
+    std::string rawData;
+    // The payload was sent as a fossil delta. Subscriptions deliver it already applied.
+    bool delta {false};
+
+    // Returns data, parsing rawData on first use. Safe to call from several threads at once,
+    // writing data or rawData meanwhile isn't.
+    auto payload() const -> nlohmann::json const &;
+
+private:
+    mutable CopyableMutex payloadMutex_;
+};
+
+// Payload which is already serialized JSON, it is put into commands as is. Copies share the
+// same immutable buffer.
+class RawJson
+{
+public:
+    RawJson() = default;
+    explicit RawJson(std::string_view json)
+        : json_ {std::make_shared<std::string const>(json)}
+    {
+    }
+    explicit RawJson(std::shared_ptr<std::string const> json)
+        : json_ {std::move(json)}
+    {
+    }
+
+    auto empty() const -> bool { return !json_ || json_->empty(); }
+    auto view() const -> std::string_view { return json_ ? *json_ : std::string_view {}; }
+
+private:
+    std::shared_ptr<std::string const> json_;
 };
 
 }
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/dispatch.hpp>
+
+#include <centrifugo.h>
+
+namespace centrifugo {
+
+struct ShardingConfig {
+    // Connections, each runs on an io_context and a thread of its own
+    std::size_t shards {2};
+    // Points of every shard on the hash ring, more of them spread channels more evenly
+    std::size_t virtualNodes {64};
+    // CPU the thread of each shard is pinned to, by shard index. Shards past the end or with a
+    // negative CPU aren't pinned. Only supported on Linux, ignored elsewhere.
+    std::vector<int> cpuAffinity;
+};
+
+// Spreads channels over several connections by consistent hashing. Every shard is a Client on a
+// thread of its own, so callbacks of different shards run concurrently and the ones set here
+// must be thread safe. ClientConfig::logHandler is shared by all shards as well.
+//
+// The server subscribes every shard to the server-side channels of the token. Their
+// publications and subscription events are only passed on by the shard the channel is assigned
+// to, so each reaches the callbacks once.
+//
+// Mirrors the API of Client. Connection callbacks run once per shard, state() is the one of the
+// least connected shard and send() goes over the first shard. publishMany() and
+// subscribeMany() split channels by shard, their frames and pacing are per shard.
+//
+// A Subscription belongs to the thread of its shard: set its callbacks up before subscribe() and
+// call it from its callbacks or through execute(). execute() blocks until its shard is done, so
+// don't call it for another shard from within a callback.
+class ShardedClient
+{
+public:
+    using SubscriptionRef = Client::SubscriptionRef;
+    using Executor = net::strand<net::io_context::executor_type>;
+
+    ShardedClient(std::string url, ClientConfig config, ShardingConfig sharding = {});
+    // Stops the threads of the shards, not to be destroyed from one of them
+    ~ShardedClient();
+
+    ShardedClient(ShardedClient const &) = delete;
+    auto operator=(ShardedClient const &) -> ShardedClient & = delete;
+
+    auto shards() const -> std::size_t;
+    // Index of the shard channel is assigned to
+    auto shard(std::string const &channel) const -> std::size_t;
+
+    auto state() const -> ConnectionState;
+
+    // Connects every shard, returns the first error
+    auto connect() -> outcome::result<void, Error>;
+    auto disconnect() -> void;
+
+    auto publish(std::string const &channel, nlohmann::json const &data)
+            -> outcome::result<void, Error>;
+    auto publish(std::string const &channel, RawJson const &data) -> outcome::result<void, Error>;
+
+    auto publishMany(std::vector<std::string> const &channels, nlohmann::json const &data)
+            -> std::vector<outcome::result<void, Error>>;
+    auto publishMany(std::vector<std::string> const &channels, RawJson const &data)
+            -> std::vector<outcome::result<void, Error>>;
+
+    auto send(nlohmann::json const &data) -> outcome::result<void, Error>;
+
+    auto newSubscription(std::string const &channel, SubscriptionOptions const &options = {})
+            -> outcome::result<SubscriptionRef, std::string>;
+    auto subscribeMany(std::vector<std::string> const &channels,
+                       SubscriptionOptions const &options = {})
+            -> std::vector<outcome::result<SubscriptionRef, std::string>>;
+    auto removeSubscription(SubscriptionRef const &sub) -> void;
+    auto removeSubscription(std::string const &channel) -> void;
+    auto subscription(std::string const &channel) const -> std::optional<SubscriptionRef>;
+    auto subscriptions() const -> std::unordered_map<std::string, SubscriptionRef>;
+
+    auto onConnecting(std::function<void(Error const &)> callback) -> void;
+    auto onConnected(std::function<void()> callback) -> void;
+    auto onDisconnected(std::function<void(Error const &)> callback) -> void;
+
+    auto onSubscribing(std::function<void(std::string const &channel)> callback) -> void;
+    auto onSubscribed(std::function<void(std::string const &channel)> callback) -> void;
+    auto onUnsubscribed(std::function<void(std::string const &channel)> callback) -> void;
+    auto
+    onPublication(std::function<void(std::string const &channel, Publication const &)> callback)
+            -> void;
+    auto onError(std::function<void(Error const &)> callback) -> void;
+    auto onSslContextConfigure(std::function<bool(boost::asio::ssl::context &)> callback) -> void;
+
+    // Runs func(Client &) on the thread of the shard of channel and returns its result
+    template<typename F>
+    auto execute(std::string const &channel, F &&func) const -> std::invoke_result_t<F, Client &>
+    {
+        return executeOn(shard(channel), std::forward<F>(func));
+    }
+
+    template<typename F>
+    auto executeOn(std::size_t shard, F &&func) const -> std::invoke_result_t<F, Client &>
+    {
+        using Result = std::invoke_result_t<F, Client &>;
+        auto task = std::packaged_task<Result()> {
+                [&func, &client = client(shard)] { return func(client); }};
+        auto result = task.get_future();
+        // Runs inline when already on the thread of the shard
+        net::dispatch(executor(shard), std::move(task));
+        return result.get();
+    }
+
+private:
+    template<typename... Args>
+    auto owned(std::size_t shard,
+               std::function<void(std::string const &, Args...)> const &callback) const
+            -> std::function<void(std::string const &, Args...)>;
+    template<typename Result, typename Many>
+    auto spread(std::vector<std::string> const &channels, Many &&many) -> std::vector<Result>;
+    auto client(std::size_t shard) const -> Client &;
+    auto executor(std::size_t shard) const -> Executor const &;
+
+    class Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+}
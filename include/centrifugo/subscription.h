@@ -2,6 +2,7 @@
 
 #include <string>
 
+#include <boost/asio/any_io_executor.hpp>
 #include <boost/outcome/outcome.hpp>
 
 #include <centrifugo/procotol.h>
@@ -13,6 +14,20 @@ namespace outcome = boost::outcome_v2;
 
 enum class SubscriptionState { UNSUBSCRIBED, SUBSCRIBING, SUBSCRIBED };
 
+struct SubscriptionOptions {
+    // Ask the server for fossil delta compressed publications, the full payload is restored
+    // from the previous publication before it is delivered
+    bool delta {false};
+    // Ask the server for a positioned stream, whose publications carry offsets going up one by
+    // one. A gap resubscribes, duplicates are dropped. Recoverable streams also get the missed
+    // publications back on resubscribe, positioned ones report them with
+    // ErrorType::PublicationsLost.
+    bool recoverable {false};
+    bool positioned {false};
+    // Get onJoin/onLeave as clients subscribe to the channel and leave it
+    bool joinLeave {false};
+};
+
 class SubscriptionImpl;
 
 class Subscription
@@ -26,13 +41,21 @@ public:
     auto subscribe() -> outcome::result<void, std::string>;
     auto unsubscribe() -> void;
     auto publish(nlohmann::json const &json) -> outcome::result<void, Error>;
+    auto publish(RawJson const &json) -> outcome::result<void, Error>;
 
     auto onSubscribing(std::function<void()> callback) -> void;
     auto onSubscribed(std::function<void()> callback) -> void;
     auto onUnsubscribed(std::function<void()> callback) -> void;
     auto onPublication(std::function<void(Publication const &)> callback) -> void;
+    auto onJoin(std::function<void(ClientInfo const &)> callback) -> void;
+    auto onLeave(std::function<void(ClientInfo const &)> callback) -> void;
     auto onError(std::function<void(Error const &)> callback) -> void;
 
+    // Runs onPublication callbacks on executor instead of the client's strand, in order through
+    // a strand on top of it. Lazily decoded payloads are parsed there as well. Publications
+    // still queued when the subscription is removed are dropped.
+    auto bindExecutor(boost::asio::any_io_executor executor) -> void;
+
 private:
     SubscriptionImpl *impl = nullptr;
 };
@@ -1,13 +1,16 @@
 #include <centrifugo.h>
 
 #include <functional>
+#include <memory>
 #include <optional>
 #include <regex>
 #include <unordered_set>
 #include <iterator>
 
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/asio/steady_timer.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
 #include <nlohmann/json.hpp>
@@ -18,22 +21,72 @@
 #include "protocol_all.h"
 #include "transport.h"
 #include "subscription_impl.h"
+#include "reply_routes.h"
 
 namespace centrifugo {
 
+namespace {
+
+// Where a server-side subscription is in its stream, so a reconnect can recover what was
+// published in between
+struct StreamPosition {
+    bool recoverable {false};
+    std::string epoch;
+    std::uint64_t offset {0};
+};
+
+}
+
 class Client::Impl
 {
 public:
+    using PublicationCallback = std::function<void(std::string const &, Publication const &)>;
+
     Impl(net::strand<net::io_context::executor_type> strand, std::string &&url,
          ClientConfig &&config)
         : logHandler_ {config.logHandler}
+        , lazyPublicationData_ {config.lazyPublicationData}
         , transport_ {strand, std::move(url), std::move(config)}
+        , scheduler_ {strand, transport_.config().subscribePacing,
+                      [this](std::string const &channel) {
+                          if (auto const sub = subscriptions_.find(channel);
+                              sub != subscriptions_.end()) {
+                              sub->second.sendScheduledSubscribe();
+                          }
+                      }}
+        , delivery_ {strand, transport_.config().workBudget,
+                     [this](std::string const &channel, Publication const &publication) {
+                         if (auto const sub = serverSubscriptions_.find(channel);
+                             sub != serverSubscriptions_.end()) {
+                             handleServerPublication(channel, sub->second, publication);
+                         } else if (auto const itr = subscriptions_.find(channel);
+                                    itr != subscriptions_.end()) {
+                             itr->second.handlePublish(publication);
+                         }
+                     }}
     {
+        if (auto const workers = transport_.config().dispatchWorkers; workers > 0) {
+            workers_.emplace(workers);
+            workerStrands_.reserve(workers);
+            for (auto i = std::size_t {0}; i < workers; ++i) {
+                workerStrands_.push_back(net::make_strand(workers_->get_executor()));
+            }
+        }
+
         transport_.onReplyReceived().connect([this](Reply const &reply) {
-            for (auto &[channel, subscription] : subscriptions_) {
-                if (subscription.handleReply(reply)) {
-                    return;
-                }
+            // Replies to commands go to the subscription which sent them, pushes (id 0) are
+            // routed by channel in handlePush(). Server-side channels have no subscription to
+            // go to.
+            auto const sub = replyRoutes_.find(reply.id);
+            // A command past its reply deadline may still get its reply, one failed otherwise
+            // won't
+            if (auto const *error = std::get_if<ErrorReply>(&reply.result);
+                !error || !error->replyMayFollow) {
+                replyRoutes_.remove(reply.id);
+            }
+            if (sub) {
+                (*sub)->handleReply(reply);
+                return;
             }
 
             std::visit(
@@ -52,10 +105,30 @@ public:
                     reply.result);
         });
 
+        transport_.onConnectRequest().connect([this](ConnectRequest &req) {
+            for (auto const &[channel, position] : serverSubscriptions_) {
+                if (!position.recoverable || position.epoch.empty()) {
+                    continue;
+                }
+                auto sub = SubscribeRequest {};
+                sub.channel = channel;
+                sub.recover = true;
+                sub.epoch = position.epoch;
+                sub.offset = position.offset;
+                req.subs.emplace(channel, std::move(sub));
+            }
+        });
+
         transport_.onConnecting().connect([this](auto const &) {
+            // Replies to commands of the lost connection never arrive, subscriptions queue
+            // their subscribes again once connected
+            replyRoutes_.clear();
+            scheduler_.clear();
+            delivery_.clear();
+
             if (onSubscribing_) {
-                for (auto const &chan : serverSubscriptions_) {
-                    onSubscribing_(chan);
+                for (auto const &sub : serverSubscriptions_) {
+                    onSubscribing_(sub.first);
                 }
             }
         });
@@ -63,9 +136,9 @@ public:
         transport_.onConnected().connect([this](ConnectResult const &result) {
             auto it = serverSubscriptions_.begin();
             while (it != serverSubscriptions_.end()) {
-                if (result.subs.count(*it) == 0) {
+                if (result.subs.count(it->first) == 0) {
                     if (onUnsubscribed_) {
-                        onUnsubscribed_(*it);
+                        onUnsubscribed_(it->first);
                     }
                     it = serverSubscriptions_.erase(it);
                 } else {
@@ -74,31 +147,58 @@ public:
             }
 
             for (auto const &[channel, subResult] : result.subs) {
-                if (serverSubscriptions_.count(channel) == 0) {
-                    serverSubscriptions_.emplace(channel);
-                    if (onSubscribing_) {
-                        onSubscribing_(channel);
-                    }
+                // Client-side subscriptions sent within connect take their own result
+                if (subscriptions_.count(channel) > 0) {
+                    continue;
+                }
+                auto const [sub, inserted] = serverSubscriptions_.try_emplace(channel);
+                if (inserted && onSubscribing_) {
+                    onSubscribing_(channel);
+                }
+
+                // Recovered publications advance the offset as they are delivered
+                auto &position = sub->second;
+                position.recoverable = subResult.recoverable;
+                position.epoch = subResult.epoch;
+                if (subResult.publications.empty()) {
+                    position.offset = subResult.offset;
+                }
+                if (subResult.was_recovering && !subResult.recovered && onError_) {
+                    onError_(Error {ErrorType::PublicationsLost,
+                                    "cannot recover publications in channel " + channel});
                 }
 
                 if (onSubscribed_) {
                     onSubscribed_(channel);
                 }
+                // Live publications come in later messages, recovered ones go first
+                delivery_.cancel(channel);
+                delivery_.deliver(channel, subResult.publications);
             }
         });
 
         transport_.onDisconnected().connect([this](auto const &) {
+            delivery_.clear();
             if (onUnsubscribed_) {
-                for (auto const &chan : serverSubscriptions_) {
-                    onUnsubscribed_(chan);
+                for (auto const &sub : serverSubscriptions_) {
+                    onUnsubscribed_(sub.first);
                 }
             }
         });
     }
 
+    // Posted deliveries refer to the client, none may run once it starts going away
+    ~Impl()
+    {
+        if (workers_) {
+            workers_->stop();
+            workers_->join();
+        }
+    }
+
     auto transport() -> Transport & { return transport_; }
 
-    auto newSubscription(std::string const &channel)
+    auto newSubscription(std::string const &channel, SubscriptionOptions const &options)
             -> outcome::result<std::reference_wrapper<Subscription>, std::string>
     {
         if (subscriptions_.find(channel) != subscriptions_.end()) {
@@ -108,13 +208,40 @@ public:
             return std::string {"channel " + channel
                                 + " already exists as server-side subscription"};
         }
-        auto &sub = subscriptions_.emplace(channel, SubscriptionImpl {channel, transport_})
-                            .first->second.subscription();
-        return sub;
+        auto &impl = subscriptions_
+                             .emplace(channel,
+                                      SubscriptionImpl {channel, transport_, scheduler_,
+                                                       delivery_, replyRoutes_, options})
+                             .first->second;
+        if (workers_) {
+            impl.setExecutor(worker(channel));
+        }
+        return impl.subscription();
+    }
+
+    auto subscribeMany(std::vector<std::string> const &channels,
+                       SubscriptionOptions const &options)
+            -> std::vector<outcome::result<SubscriptionRef, std::string>>
+    {
+        auto results = std::vector<outcome::result<SubscriptionRef, std::string>> {};
+        results.reserve(channels.size());
+        for (auto const &channel : channels) {
+            auto sub = newSubscription(channel, options);
+            if (sub) {
+                if (auto subscribed = sub.value().get().subscribe(); !subscribed) {
+                    results.push_back(subscribed.error());
+                    continue;
+                }
+            }
+            results.push_back(std::move(sub));
+        }
+        return results;
     }
 
     auto removeSubscription(SubscriptionRef const &sub) -> void
     {
+        scheduler_.cancel(sub.get().channel());
+        delivery_.cancel(sub.get().channel());
         subscriptions_.erase(sub.get().channel());
     }
 
@@ -151,10 +278,10 @@ public:
         onUnsubscribed_ = std::move(callback);
     }
 
-    auto onPublication(std::function<void(std::string const &, Publication const &)> callback)
-            -> void
+    auto onPublication(PublicationCallback callback) -> void
     {
-        onPublication_ = std::move(callback);
+        onPublication_ = callback ? std::make_shared<PublicationCallback const>(std::move(callback))
+                                  : nullptr;
     }
 
     auto onError(std::function<void(Error const &)> callback) -> void
@@ -171,21 +298,95 @@ public:
             return Error {ErrorType::NotSubscribed, "not subscribed"};
         }
 
-        transport_.send(makeCommand(PublishRequest {channel, data}));
+        if (auto const id = transport_.publish(PublishRequest {channel, &data, {}},
+                                               parkedPublishHandler());
+            !id) {
+            return id.assume_error();
+        }
         return outcome::success();
     }
 
+    auto publish(std::string const &channel, RawJson const &data) -> outcome::result<void, Error>
+    {
+        if (transport_.config().validateRawJson && !nlohmann::json::accept(data.view())) {
+            return Error {ErrorType::InvalidJson, "publish data is not valid JSON"};
+        }
+        return publishRaw(channel, data);
+    }
+
+    auto publishMany(std::vector<std::string> const &channels, nlohmann::json const &data)
+            -> std::vector<outcome::result<void, Error>>
+    {
+        // Binary payloads go out as protobuf bytes, they have no JSON form to share
+        if (data.is_binary()) {
+            auto results = std::vector<outcome::result<void, Error>> {};
+            results.reserve(channels.size());
+            for (auto const &channel : channels) {
+                results.push_back(publish(channel, data));
+            }
+            return results;
+        }
+
+        auto const raw = RawJson {data.dump()};
+        return publishMany(channels, raw, false);
+    }
+
+    auto publishMany(std::vector<std::string> const &channels, RawJson const &data,
+                     bool validate = true) -> std::vector<outcome::result<void, Error>>
+    {
+        if (validate && transport_.config().validateRawJson
+            && !nlohmann::json::accept(data.view())) {
+            auto const error = Error {ErrorType::InvalidJson, "publish data is not valid JSON"};
+            return std::vector<outcome::result<void, Error>>(channels.size(), error);
+        }
+
+        // Every command shares the buffer of data and lands in the frame of the next flush
+        auto results = std::vector<outcome::result<void, Error>> {};
+        results.reserve(channels.size());
+        for (auto const &channel : channels) {
+            results.push_back(publishRaw(channel, data));
+        }
+        return results;
+    }
+
     auto send(nlohmann::json const &data) -> outcome::result<void, Error>
     {
         if (transport_.state() != ConnectionState::Connected) {
             return Error {ErrorType::NotConnected, "not connected"};
         }
 
-        transport_.send(makeCommand(SendRequest {data}));
+        transport_.send(SendRequest {data});
         return outcome::success();
     }
 
 private:
+    auto publishRaw(std::string const &channel, RawJson const &data) -> outcome::result<void, Error>
+    {
+        if (transport_.state() != ConnectionState::Connected
+            || serverSubscriptions_.count(channel) == 0) {
+            return Error {ErrorType::NotSubscribed, "not subscribed"};
+        }
+
+        auto req = PublishRequest {};
+        req.channel = channel;
+        req.raw = data;
+        if (auto const id = transport_.publish(std::move(req), parkedPublishHandler()); !id) {
+            return id.assume_error();
+        }
+        return outcome::success();
+    }
+
+    // Replies to publishes of server-side channels come to the client, only a failure to queue
+    // a parked one is left to report
+    auto parkedPublishHandler() -> Transport::PublishHandler
+    {
+        return [this](outcome::result<std::uint32_t, Error> id) {
+            if (!id && onError_) {
+                onError_(id.assume_error());
+            }
+        };
+    }
+
     auto handlePush(Push const &push) -> void
     {
         std::visit(
@@ -193,10 +394,13 @@ private:
                     using PushType = std::decay_t<decltype(type)>;
 
                     if constexpr (std::is_same_v<PushType, Publication>) {
-                        if (serverSubscriptions_.count(push.channel)) {
-                            if (onPublication_) {
-                                onPublication_(push.channel, type);
-                            }
+                        // Keeps behind publications recovered for the channel
+                        if (delivery_.enqueue(push.channel, type)) {
+                            return;
+                        }
+                        if (auto const sub = serverSubscriptions_.find(push.channel);
+                            sub != serverSubscriptions_.end()) {
+                            handleServerPublication(push.channel, sub->second, type);
                             return;
                         }
 
@@ -213,14 +417,29 @@ private:
                                                   {{"channel", push.channel}}});
                         }
                     } else if constexpr (std::is_same_v<PushType, Subscribe>) {
-                        if (auto const [_, inserted] = serverSubscriptions_.emplace(push.channel);
-                            inserted && onSubscribing_) {
+                        auto const [sub, inserted] = serverSubscriptions_.try_emplace(push.channel);
+                        if (inserted && onSubscribing_) {
                             onSubscribing_(push.channel);
                         }
+                        sub->second.recoverable = type.recoverable;
+                        sub->second.epoch = type.epoch;
+                        sub->second.offset = type.offset;
                         if (onSubscribed_) {
                             onSubscribed_(push.channel);
                         }
+                    } else if constexpr (std::is_same_v<PushType, Join>
+                                         || std::is_same_v<PushType, Leave>) {
+                        // Presence of server-side subscriptions isn't surfaced
+                        if (auto itr = subscriptions_.find(push.channel);
+                            itr != std::end(subscriptions_)) {
+                            if constexpr (std::is_same_v<PushType, Join>) {
+                                itr->second.handleJoin(type);
+                            } else {
+                                itr->second.handleLeave(type);
+                            }
+                        }
                     } else if constexpr (std::is_same_v<PushType, Unsubscribe>) {
+                        delivery_.cancel(push.channel);
                         if (serverSubscriptions_.erase(push.channel) && onUnsubscribed_) {
                             onUnsubscribed_(push.channel);
                         }
@@ -229,23 +448,58 @@ private:
                 push.type);
     }
 
-    auto sendSubscribeCmd(std::string const &channel) -> void
+    auto handleServerPublication(std::string const &channel, StreamPosition &position,
+                                 Publication const &publication) -> void
     {
-        auto req = SubscribeRequest {};
-        req.channel = channel;
-        transport_.send(makeCommand(std::move(req)));
+        if (publication.offset > 0) {
+            position.offset = publication.offset;
+        }
+        if (!onPublication_) {
+            return;
+        }
+        if (!workers_) {
+            if (!lazyPublicationData_) {
+                publication.payload();
+            }
+            (*onPublication_)(channel, publication);
+            return;
+        }
+
+        // By copy, the reply is gone by the time a worker gets to it. The worker doesn't touch
+        // the client, onPublication() may replace the callback meanwhile.
+        net::post(worker(channel), [callback = onPublication_, lazy = lazyPublicationData_,
+                                    channel, publication] {
+            if (!lazy) {
+                publication.payload();
+            }
+            (*callback)(channel, publication);
+        });
+    }
+
+    // Strand of the dispatch worker channel is pinned to
+    auto worker(std::string const &channel) -> net::any_io_executor
+    {
+        return workerStrands_[std::hash<std::string> {}(channel) % workerStrands_.size()];
     }
 
 private:
     std::function<void(LogEntry)> logHandler_;
+    bool lazyPublicationData_;
+    ReplyRoutes replyRoutes_;
     Transport transport_;
+    SubscribeScheduler scheduler_;
+    DeliveryQueue delivery_;
     std::unordered_map<std::string, SubscriptionImpl> subscriptions_;
-    std::unordered_set<std::string> serverSubscriptions_;
+    std::unordered_map<std::string, StreamPosition> serverSubscriptions_;
+    // Parse payloads and run onPublication callbacks with ClientConfig::dispatchWorkers
+    std::optional<net::thread_pool> workers_;
+    std::vector<net::strand<net::thread_pool::executor_type>> workerStrands_;
 
     std::function<void(std::string const &)> onSubscribing_;
     std::function<void(std::string const &)> onSubscribed_;
     std::function<void(std::string const &)> onUnsubscribed_;
-    std::function<void(std::string const &, Publication const &)> onPublication_;
+    // Shared with the publications handed to dispatch workers
+    std::shared_ptr<PublicationCallback const> onPublication_;
     std::function<void(Error const &)> onError_;
 };
 
@@ -272,6 +526,11 @@ auto Client::state() const -> ConnectionState
     return pImpl->transport().state();
 }
 
+auto Client::writeStats() const -> WriteStats
+{
+    return pImpl->transport().writeStats();
+}
+
 auto Client::onConnecting(std::function<void(Error const &)> callback) -> void
 {
     pImpl->transport().onConnecting().connect(callback);
@@ -288,10 +547,17 @@ auto Client::onDisconnected(std::function<void(Error const &)> callback) -> void
     pImpl->transport().onDisconnected().connect(callback);
 }
 
-auto Client::newSubscription(std::string const &channel)
+auto Client::newSubscription(std::string const &channel, SubscriptionOptions const &options)
         -> outcome::result<std::reference_wrapper<Subscription>, std::string>
 {
-    return pImpl->newSubscription(channel);
+    return pImpl->newSubscription(channel, options);
+}
+
+auto Client::subscribeMany(std::vector<std::string> const &channels,
+                           SubscriptionOptions const &options)
+        -> std::vector<outcome::result<SubscriptionRef, std::string>>
+{
+    return pImpl->subscribeMany(channels, options);
 }
 
 auto Client::removeSubscription(SubscriptionRef const &sub) -> void
@@ -346,6 +612,24 @@ auto Client::publish(std::string const &channel, nlohmann::json const &data)
     return pImpl->publish(channel, data);
 }
 
+auto Client::publish(std::string const &channel, RawJson const &data)
+        -> outcome::result<void, Error>
+{
+    return pImpl->publish(channel, data);
+}
+
+auto Client::publishMany(std::vector<std::string> const &channels, nlohmann::json const &data)
+        -> std::vector<outcome::result<void, Error>>
+{
+    return pImpl->publishMany(channels, data);
+}
+
+auto Client::publishMany(std::vector<std::string> const &channels, RawJson const &data)
+        -> std::vector<outcome::result<void, Error>>
+{
+    return pImpl->publishMany(channels, data);
+}
+
 auto Client::send(nlohmann::json const &data) -> outcome::result<void, Error>
 {
     return pImpl->send(data);
@@ -0,0 +1,95 @@
+#include "delivery_queue.h"
+
+#include <algorithm>
+
+namespace centrifugo {
+
+DeliveryQueue::DeliveryQueue(
+        boost::asio::strand<boost::asio::io_context::executor_type> const &strand,
+        std::size_t budget, DeliverFunc deliver)
+    : budget_ {budget}
+    , deliver_ {std::move(deliver)}
+    , timer_ {strand}
+{
+}
+
+auto DeliveryQueue::deliver(std::string const &channel,
+                            std::vector<Publication> const &publications) -> void
+{
+    auto first = publications.begin();
+    if (queue_.empty()) {
+        auto const now = budget_ == 0 ? publications.size()
+                                      : std::min(budget_, publications.size());
+        for (auto const last = first + now; first != last; ++first) {
+            deliver_(channel, *first);
+        }
+    }
+
+    for (; first != publications.end(); ++first) {
+        push(channel, *first);
+    }
+    schedule();
+}
+
+auto DeliveryQueue::enqueue(std::string const &channel, Publication const &publication) -> bool
+{
+    if (queue_.empty() || queued_.count(channel) == 0) {
+        return false;
+    }
+    push(channel, publication);
+    return true;
+}
+
+auto DeliveryQueue::cancel(std::string const &channel) -> void
+{
+    if (queued_.erase(channel) == 0) {
+        return;
+    }
+    queue_.erase(std::remove_if(queue_.begin(), queue_.end(),
+                                [&channel](auto const &item) { return item.first == channel; }),
+                 queue_.end());
+}
+
+auto DeliveryQueue::clear() -> void
+{
+    queue_.clear();
+    queued_.clear();
+}
+
+auto DeliveryQueue::push(std::string const &channel, Publication const &publication) -> void
+{
+    queue_.emplace_back(channel, publication);
+    ++queued_[channel];
+}
+
+auto DeliveryQueue::drain() -> void
+{
+    for (auto n = std::size_t {0}; n < budget_ && !queue_.empty(); ++n) {
+        auto const item = std::move(queue_.front());
+        queue_.pop_front();
+        if (auto const count = queued_.find(item.first); --count->second == 0) {
+            queued_.erase(count);
+        }
+        // May cancel or clear what is queued, nothing refers into the queue meanwhile
+        deliver_(item.first, item.second);
+    }
+    schedule();
+}
+
+auto DeliveryQueue::schedule() -> void
+{
+    if (queue_.empty() || scheduled_) {
+        return;
+    }
+    scheduled_ = true;
+    timer_.expires_at(boost::asio::steady_timer::time_point::min());
+    timer_.async_wait([this](boost::system::error_code ec) {
+        if (ec) {
+            return;
+        }
+        scheduled_ = false;
+        drain();
+    });
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+
+#include "protocol_all.h"
+
+namespace centrifugo {
+
+// Delivers recovered publications ClientConfig::workBudget at a time, the rest follows in later
+// turns of the strand so a recovery burst doesn't hold up pings and writes. Live publications of
+// a channel with a backlog queue up behind it to keep the order of the stream.
+class DeliveryQueue
+{
+public:
+    // Hands publication to the subscription of channel
+    using DeliverFunc = std::function<void(std::string const &channel, Publication const &)>;
+
+    DeliveryQueue(boost::asio::strand<boost::asio::io_context::executor_type> const &strand,
+                  std::size_t budget, DeliverFunc deliver);
+
+    DeliveryQueue(DeliveryQueue const &) = delete;
+    auto operator=(DeliveryQueue const &) -> DeliveryQueue & = delete;
+
+    // Delivers what the budget allows right away unless other publications are waiting
+    auto deliver(std::string const &channel, std::vector<Publication> const &publications)
+            -> void;
+    // Queues a live publication behind the backlog of channel, returns false if there is none
+    auto enqueue(std::string const &channel, Publication const &publication) -> bool;
+    // Drops the backlog of channel, e.g. when it subscribes again
+    auto cancel(std::string const &channel) -> void;
+    // Drops every backlog, for a connection which is gone
+    auto clear() -> void;
+
+    auto size() const -> std::size_t { return queue_.size(); }
+
+private:
+    auto push(std::string const &channel, Publication const &publication) -> void;
+    auto drain() -> void;
+    auto schedule() -> void;
+
+    std::size_t budget_;
+    DeliverFunc deliver_;
+
+    std::deque<std::pair<std::string, Publication>> queue_;
+    // Publications queued per channel
+    std::unordered_map<std::string, std::size_t> queued_;
+    // Expired right away, waits for the next turn of the strand. Unlike a post it is cancelled
+    // when the queue goes away.
+    boost::asio::steady_timer timer_;
+    bool scheduled_ {false};
+};
+
+}
@@ -0,0 +1,131 @@
+#include "fossil_delta.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace centrifugo::fossil {
+
+namespace {
+
+// Value of a base-64 digit of "0-9A-Z_a-z~", -1 for any other character
+constexpr auto digitValue(char c) -> int
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A' + 10;
+    if (c == '_')
+        return 36;
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 37;
+    if (c == '~')
+        return 63;
+    return -1;
+}
+
+class Reader
+{
+public:
+    explicit Reader(std::string_view in)
+        : in_ {in}
+    {
+    }
+
+    auto empty() const -> bool { return in_.empty(); }
+
+    auto integer() -> std::uint64_t
+    {
+        auto value = std::uint64_t {0};
+        auto digit = 0;
+        while (!in_.empty() && (digit = digitValue(in_.front())) >= 0) {
+            value = (value << 6) + static_cast<std::uint64_t>(digit);
+            in_.remove_prefix(1);
+        }
+        return value;
+    }
+
+    auto character() -> char
+    {
+        if (in_.empty()) {
+            return '\0';
+        }
+        auto const c = in_.front();
+        in_.remove_prefix(1);
+        return c;
+    }
+
+    auto bytes(std::size_t count) -> std::optional<std::string_view>
+    {
+        if (count > in_.size()) {
+            return std::nullopt;
+        }
+        auto const result = in_.substr(0, count);
+        in_.remove_prefix(count);
+        return result;
+    }
+
+private:
+    std::string_view in_;
+};
+
+// Sum of the content as big-endian 32-bit words, the last one zero padded
+auto checksum(std::string_view data) -> std::uint32_t
+{
+    auto sum = std::uint32_t {0};
+    auto shift = 24;
+    for (auto const c : data) {
+        sum += static_cast<std::uint32_t>(static_cast<unsigned char>(c)) << shift;
+        shift = shift == 0 ? 24 : shift - 8;
+    }
+    return sum;
+}
+
+}
+
+auto applyDelta(std::string_view source, std::string_view delta) -> std::optional<std::string>
+{
+    auto r = Reader {delta};
+    auto const size = r.integer();
+    if (r.character() != '\n') {
+        return std::nullopt;
+    }
+
+    // size comes from the wire, don't trust it for more than the input could produce in one go
+    auto target = std::string {};
+    target.reserve(std::min<std::uint64_t>(size, source.size() + delta.size()));
+    while (!r.empty()) {
+        auto const count = r.integer();
+        switch (r.character()) {
+        case '@': {
+            auto const offset = r.integer();
+            if (!r.empty() && r.character() != ',') {
+                return std::nullopt;
+            }
+            if (count > size - target.size() || offset > source.size()
+                || count > source.size() - offset) {
+                return std::nullopt;
+            }
+            target.append(source.substr(offset, count));
+            break;
+        }
+        case ':': {
+            auto const literal = r.bytes(count);
+            if (!literal || count > size - target.size()) {
+                return std::nullopt;
+            }
+            target.append(*literal);
+            break;
+        }
+        case ';':
+            if (target.size() != size || count != checksum(target)) {
+                return std::nullopt;
+            }
+            return target;
+        default:
+            return std::nullopt;
+        }
+    }
+    return std::nullopt; // no terminating checksum
+}
+
+}
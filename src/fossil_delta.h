@@ -0,0 +1,15 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Fossil delta format Centrifugo uses for delta compressed publications, see
+// https://fossil-scm.org/home/doc/tip/www/delta_format.wiki
+namespace centrifugo::fossil {
+
+// Applies delta to source and returns the target, std::nullopt when delta is malformed, doesn't
+// fit source or fails its checksum
+auto applyDelta(std::string_view source, std::string_view delta) -> std::optional<std::string>;
+
+}
@@ -0,0 +1,101 @@
+#include "inflight_commands.h"
+
+#include <algorithm>
+
+namespace centrifugo {
+
+constexpr auto INITIAL_CAPACITY = std::size_t {64};
+
+auto InFlightCommands::add(Entry const &entry) -> void
+{
+    if (count_ == 0) {
+        head_ = 0;
+        frontId_ = entry.id;
+    }
+
+    // Ids of commands that never got queued leave free slots behind
+    auto const index = static_cast<std::size_t>(entry.id - frontId_);
+    while (index >= ring_.size()) {
+        grow();
+    }
+    slot(entry.id) = entry;
+    count_ = std::max(count_, index + 1);
+    ++live_;
+}
+
+auto InFlightCommands::complete(std::uint32_t id) -> std::optional<Entry>
+{
+    auto const *found = find(id);
+    if (!found) {
+        return std::nullopt;
+    }
+
+    auto const entry = *found;
+    slot(id).id = 0;
+    --live_;
+
+    // Free slots at the front are released so the ring only spans live entries
+    while (count_ > 0 && ring_[head_].id == 0) {
+        head_ = (head_ + 1) & (ring_.size() - 1);
+        ++frontId_;
+        --count_;
+    }
+    return entry;
+}
+
+auto InFlightCommands::find(std::uint32_t id) const -> Entry const *
+{
+    if (id == 0 || count_ == 0 || id - frontId_ >= count_) {
+        return nullptr;
+    }
+    auto const &entry = ring_[(head_ + (id - frontId_)) & (ring_.size() - 1)];
+    return entry.id == id ? &entry : nullptr;
+}
+
+auto InFlightCommands::stale(std::uint32_t newestId) const -> std::uint32_t
+{
+    // The front slot always holds a live entry
+    if (count_ == 0 || newestId - frontId_ < MAX_SPAN) {
+        return 0;
+    }
+    return frontId_;
+}
+
+auto InFlightCommands::ids() const -> std::vector<std::uint32_t>
+{
+    auto ids = std::vector<std::uint32_t> {};
+    ids.reserve(live_);
+    for (auto i = std::size_t {0}; i < count_; ++i) {
+        if (auto const id = ring_[(head_ + i) & (ring_.size() - 1)].id) {
+            ids.push_back(id);
+        }
+    }
+    return ids;
+}
+
+auto InFlightCommands::clear() -> void
+{
+    for (auto &entry : ring_) {
+        entry.id = 0;
+    }
+    head_ = 0;
+    count_ = 0;
+    live_ = 0;
+}
+
+auto InFlightCommands::slot(std::uint32_t id) -> Entry &
+{
+    return ring_[(head_ + (id - frontId_)) & (ring_.size() - 1)];
+}
+
+auto InFlightCommands::grow() -> void
+{
+    auto grown = std::vector<Entry>(ring_.empty() ? INITIAL_CAPACITY : ring_.size() * 2);
+    for (auto i = std::size_t {0}; i < count_; ++i) {
+        grown[i] = ring_[(head_ + i) & (ring_.size() - 1)];
+    }
+    ring_ = std::move(grown);
+    head_ = 0;
+}
+
+}
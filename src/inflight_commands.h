@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace centrifugo {
+
+// Commands waiting for their reply. Ids are handed out in increasing order, so entries sit in
+// a ring indexed by distance from the oldest id; replies may complete them in any order.
+// Only metadata is kept, never the request itself.
+class InFlightCommands
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr auto MAX_SPAN = std::uint32_t {1} << 16;
+
+    struct Entry {
+        std::uint32_t id {0};
+        // Index of the request in Command::RequestType
+        std::uint8_t requestType {0};
+        Clock::time_point queuedAt;
+        // TimerWheel::TimerId of the reply deadline
+        std::uint64_t deadline {0};
+    };
+
+    // entry.id must be greater than the ids added before
+    auto add(Entry const &entry) -> void;
+    // Removes and returns the entry of id, std::nullopt if it isn't in flight
+    auto complete(std::uint32_t id) -> std::optional<Entry>;
+    auto find(std::uint32_t id) const -> Entry const *;
+    // Id of the oldest entry once it is MAX_SPAN or more ids behind newestId, 0 otherwise. Even
+    // without reply deadlines a command which is never answered then can't keep the ring
+    // growing, its owner is expected to fail it.
+    auto stale(std::uint32_t newestId) const -> std::uint32_t;
+    // Ids in flight, oldest first
+    auto ids() const -> std::vector<std::uint32_t>;
+    auto clear() -> void;
+
+    auto size() const -> std::size_t { return live_; }
+    auto empty() const -> bool { return live_ == 0; }
+
+private:
+    auto slot(std::uint32_t id) -> Entry &;
+    auto grow() -> void;
+
+    // Capacity is a power of two, a slot with id 0 is free
+    std::vector<Entry> ring_;
+    std::size_t head_ {0};
+    std::size_t count_ {0};
+    std::size_t live_ {0};
+    std::uint32_t frontId_ {0};
+};
+
+}
@@ -1,19 +1,664 @@
 #include "protocol_all.h"
 
+#include <algorithm>
+#include <charconv>
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <utility>
+
 namespace centrifugo {
 
 using json = nlohmann::json;
 
-auto to_json(json &j, ConnectRequest const &req) -> void
+namespace {
+
+// Raw "data" values cut out of a message by parseEnvelope()
+using Payloads = std::vector<std::string_view>;
+
+#ifndef CENTRIFUGO_USE_SIMDJSON
+auto isSpace(char c) -> bool
 {
-    j = json {{"name", req.name}};
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Iterator over a message which counts the bytes the parser has read from it
+class CountingIterator
+{
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = char;
+    using difference_type = std::ptrdiff_t;
+    using pointer = char const *;
+    using reference = char const &;
+
+    CountingIterator(char const *pos, std::size_t *read)
+        : pos_ {pos}
+        , read_ {read}
+    {
+    }
+
+    auto operator*() const -> reference { return *pos_; }
+    auto operator++() -> CountingIterator &
+    {
+        ++pos_;
+        ++*read_;
+        return *this;
+    }
+    auto operator++(int) -> CountingIterator
+    {
+        auto const previous = *this;
+        ++*this;
+        return previous;
+    }
+    auto operator==(CountingIterator const &other) const -> bool { return pos_ == other.pos_; }
+    auto operator!=(CountingIterator const &other) const -> bool { return pos_ != other.pos_; }
+
+private:
+    char const *pos_;
+    std::size_t *read_;
+};
+
+// SAX handler building the DOM of a message with the value of every "data" member replaced by
+// the index of its raw bytes in payloads, so that payloads aren't parsed into a DOM. Bytes are
+// located by what the parser has read when it reports a value: keys, strings and brackets are
+// read exactly, numbers and literals at most one byte ahead. User defined objects (tags,
+// conn_info and chan_info) are taken as a whole, "data" keys nested in them aren't cut.
+class PayloadCutter
+{
+public:
+    using number_integer_t = json::number_integer_t;
+    using number_unsigned_t = json::number_unsigned_t;
+    using number_float_t = json::number_float_t;
+    using string_t = json::string_t;
+    using binary_t = json::binary_t;
+
+    PayloadCutter(std::string_view message, std::size_t const &read, json &root,
+                  Payloads &payloads)
+        : message_ {message}
+        , read_ {read}
+        , dom_ {root}
+        , payloads_ {payloads}
+    {
+    }
+
+    auto null() -> bool
+    {
+        return scalar([&] { return dom_.null(); });
+    }
+    auto boolean(bool value) -> bool
+    {
+        return scalar([&] { return dom_.boolean(value); });
+    }
+    auto number_integer(number_integer_t value) -> bool
+    {
+        return scalar([&] { return dom_.number_integer(value); });
+    }
+    auto number_unsigned(number_unsigned_t value) -> bool
+    {
+        return scalar([&] { return dom_.number_unsigned(value); });
+    }
+    auto number_float(number_float_t value, string_t const &text) -> bool
+    {
+        return scalar([&] { return dom_.number_float(value, text); });
+    }
+    auto string(string_t &value) -> bool
+    {
+        return scalar([&] { return dom_.string(value); });
+    }
+    auto binary(binary_t &value) -> bool
+    {
+        return scalar([&] { return dom_.binary(value); });
+    }
+
+    auto start_object(std::size_t size) -> bool
+    {
+        return open([&] { return dom_.start_object(size); });
+    }
+    auto end_object() -> bool
+    {
+        return close([&] { return dom_.end_object(); });
+    }
+    auto start_array(std::size_t size) -> bool
+    {
+        return open([&] { return dom_.start_array(size); });
+    }
+    auto end_array() -> bool
+    {
+        return close([&] { return dom_.end_array(); });
+    }
+
+    auto key(string_t &key) -> bool
+    {
+        if (payloadDepth_ > 0) {
+            return true;
+        }
+        if (userDepth_ == 0) {
+            if (key == "data") {
+                next_ = Next::Payload;
+                keyEnd_ = read_;
+            } else if (key == "tags" || key == "conn_info" || key == "chan_info") {
+                next_ = Next::User;
+            }
+        }
+        return dom_.key(key);
+    }
+
+    template<typename Exception>
+    auto parse_error(std::size_t position, std::string const &token, Exception const &error)
+            -> bool
+    {
+        return dom_.parse_error(position, token, error);
+    }
+
+private:
+    enum class Next { Plain, Payload, User };
+
+    template<typename Forward>
+    auto scalar(Forward &&forward) -> bool
+    {
+        if (payloadDepth_ > 0) {
+            return true;
+        }
+        if (std::exchange(next_, Next::Plain) != Next::Payload) {
+            return forward();
+        }
+        // Past the value are at most the byte read ahead and whitespace before it
+        auto end = read_;
+        while (end > 0 && (isSpace(message_[end - 1]) || message_[end - 1] == ','
+                           || message_[end - 1] == '}' || message_[end - 1] == ']')) {
+            --end;
+        }
+        return cut(valueStart(), end);
+    }
+
+    template<typename Forward>
+    auto open(Forward &&forward) -> bool
+    {
+        if (payloadDepth_ > 0) {
+            ++payloadDepth_;
+            return true;
+        }
+        switch (std::exchange(next_, Next::Plain)) {
+        case Next::Payload:
+            payloadStart_ = valueStart();
+            payloadDepth_ = 1;
+            return true;
+        case Next::User:
+            userDepth_ = 1;
+            break;
+        case Next::Plain:
+            userDepth_ += userDepth_ > 0;
+            break;
+        }
+        return forward();
+    }
+
+    template<typename Forward>
+    auto close(Forward &&forward) -> bool
+    {
+        if (payloadDepth_ > 0) {
+            return --payloadDepth_ > 0 || cut(payloadStart_, read_);
+        }
+        userDepth_ -= userDepth_ > 0;
+        return forward();
+    }
+
+    // The value of the "data" key read last starts after its colon
+    auto valueStart() const -> std::size_t
+    {
+        auto pos = keyEnd_;
+        while (pos < message_.size() && (isSpace(message_[pos]) || message_[pos] == ':')) {
+            ++pos;
+        }
+        return pos;
+    }
+
+    auto cut(std::size_t start, std::size_t end) -> bool
+    {
+        payloads_.push_back(message_.substr(start, end - start));
+        return dom_.number_unsigned(payloads_.size() - 1);
+    }
+
+    std::string_view message_;
+    std::size_t const &read_;
+    nlohmann::detail::json_sax_dom_parser<json> dom_;
+    Payloads &payloads_;
+    Next next_ {Next::Plain};
+    std::size_t keyEnd_ {0};
+    std::size_t payloadStart_ {0};
+    // Brackets open in the current payload and user defined object
+    std::size_t payloadDepth_ {0};
+    std::size_t userDepth_ {0};
+};
+
+// Parses message into a DOM whose "data" members are indices of their raw bytes in payloads
+auto parseEnvelope(std::string_view message, Payloads &payloads) -> json
+{
+    auto root = json {};
+    auto read = std::size_t {0};
+    auto cutter = PayloadCutter {message, read, root, payloads};
+    json::sax_parse(CountingIterator {message.data(), &read},
+                    CountingIterator {message.data() + message.size(), &read},
+                    &cutter);
+    return root;
+}
+#endif
+
+// Payloads of a DOM owned by the decoder are moved out instead of deep copied
+template<typename J>
+auto take(J &value) -> decltype(auto)
+{
+    if constexpr (std::is_const_v<J>) {
+        return value;
+    } else {
+        return std::move(value);
+    }
+}
+
+// Object members are visited once and dispatched through a switch over keyHash() of their key,
+// one compare then rules out unknown keys sharing the hash of a known one.
+
+template<typename J>
+auto read(J &j, ClientInfo &info) -> void
+{
+    if (!j.is_object())
+        return;
+
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        auto const &key = it.key();
+        auto &value = it.value();
+        switch (keyHash(key)) {
+        case keyHash("user"):
+            if (key == "user")
+                value.get_to(info.user);
+            break;
+        case keyHash("client"):
+            if (key == "client")
+                value.get_to(info.client);
+            break;
+        }
+    }
+}
+
+template<typename J>
+auto read(J &j, Publication &pub, Payloads const *payloads = nullptr) -> void
+{
+    if (!j.is_object())
+        return;
+
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        auto const &key = it.key();
+        auto &value = it.value();
+        switch (keyHash(key)) {
+        case keyHash("offset"):
+            if (key == "offset")
+                value.get_to(pub.offset);
+            break;
+        case keyHash("data"):
+            if (key == "data") {
+                if (payloads) {
+                    pub.rawData = payloads->at(value.template get<std::size_t>());
+                } else {
+                    pub.data = take(value);
+                }
+            }
+            break;
+        case keyHash("info"):
+            if (key == "info")
+                read(value, pub.info.emplace());
+            break;
+        case keyHash("tags"):
+            if (key == "tags")
+                value.get_to(pub.tags);
+            break;
+        case keyHash("delta"):
+            if (key == "delta")
+                value.get_to(pub.delta);
+            break;
+        }
+    }
+}
+
+template<typename J>
+auto read(J &j, Subscribe &sub) -> void
+{
+    if (!j.is_object())
+        return;
+
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        auto const &key = it.key();
+        auto &value = it.value();
+        switch (keyHash(key)) {
+        case keyHash("recoverable"):
+            if (key == "recoverable")
+                value.get_to(sub.recoverable);
+            break;
+        case keyHash("epoch"):
+            if (key == "epoch")
+                value.get_to(sub.epoch);
+            break;
+        case keyHash("offset"):
+            if (key == "offset")
+                value.get_to(sub.offset);
+            break;
+        case keyHash("positioned"):
+            if (key == "positioned")
+                value.get_to(sub.positioned);
+            break;
+        }
+    }
+}
+
+template<typename J>
+auto read(J &j, Unsubscribe &unsub) -> void
+{
+    if (!j.is_object())
+        return;
+
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        auto const &key = it.key();
+        auto &value = it.value();
+        switch (keyHash(key)) {
+        case keyHash("code"):
+            if (key == "code")
+                value.get_to(unsub.code);
+            break;
+        case keyHash("reason"):
+            if (key == "reason")
+                value.get_to(unsub.reason);
+            break;
+        }
+    }
+}
+
+// Join and Leave only carry the info of the client
+template<typename J, typename Presence>
+auto readPresence(J &j, Presence &presence) -> void
+{
+    if (!j.is_object())
+        return;
+
+    if (auto const it = j.find("info"); it != j.end())
+        read(*it, presence.info);
+}
+
+template<typename J>
+auto read(J &j, Push &push, Payloads const *payloads = nullptr) -> void
+{
+    if (!j.is_object())
+        return;
+
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        auto const &key = it.key();
+        auto &value = it.value();
+        switch (keyHash(key)) {
+        case keyHash("channel"):
+            if (key == "channel")
+                value.get_to(push.channel);
+            break;
+        case keyHash("pub"):
+            if (key == "pub")
+                read(value, push.type.template emplace<Publication>(), payloads);
+            break;
+        case keyHash("subscribe"):
+            if (key == "subscribe")
+                read(value, push.type.template emplace<Subscribe>());
+            break;
+        case keyHash("unsubscribe"):
+            if (key == "unsubscribe")
+                read(value, push.type.template emplace<Unsubscribe>());
+            break;
+        case keyHash("join"):
+            if (key == "join")
+                readPresence(value, push.type.template emplace<Join>());
+            break;
+        case keyHash("leave"):
+            if (key == "leave")
+                readPresence(value, push.type.template emplace<Leave>());
+            break;
+        }
+    }
+}
+
+template<typename J>
+auto read(J &j, SubscribeResult &result, Payloads const *payloads = nullptr) -> void
+{
+    if (!j.is_object())
+        return;
+
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        auto const &key = it.key();
+        auto &value = it.value();
+        switch (keyHash(key)) {
+        case keyHash("expires"):
+            if (key == "expires")
+                value.get_to(result.expires);
+            break;
+        case keyHash("ttl"):
+            if (key == "ttl")
+                value.get_to(result.ttl);
+            break;
+        case keyHash("recoverable"):
+            if (key == "recoverable")
+                value.get_to(result.recoverable);
+            break;
+        case keyHash("epoch"):
+            if (key == "epoch")
+                value.get_to(result.epoch);
+            break;
+        case keyHash("publications"):
+            if (key == "publications") {
+                result.publications.reserve(value.size());
+                for (auto &pub : value) {
+                    read(pub, result.publications.emplace_back(), payloads);
+                }
+            }
+            break;
+        case keyHash("recovered"):
+            if (key == "recovered")
+                value.get_to(result.recovered);
+            break;
+        case keyHash("offset"):
+            if (key == "offset")
+                value.get_to(result.offset);
+            break;
+        case keyHash("positioned"):
+            if (key == "positioned")
+                value.get_to(result.positioned);
+            break;
+        case keyHash("data"):
+            if (key == "data") {
+                auto const data = payloads
+                        ? std::string {payloads->at(value.template get<std::size_t>())}
+                        : value.dump();
+                result.data.assign(data.begin(), data.end());
+            }
+            break;
+        case keyHash("was_recovering"):
+            if (key == "was_recovering")
+                value.get_to(result.was_recovering);
+            break;
+        case keyHash("delta"):
+            if (key == "delta")
+                value.get_to(result.delta);
+            break;
+        }
+    }
+}
+
+template<typename J>
+auto read(J &j, ConnectResult &result, Payloads const *payloads = nullptr) -> void
+{
+    if (!j.is_object())
+        return;
+
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        auto const &key = it.key();
+        auto &value = it.value();
+        switch (keyHash(key)) {
+        case keyHash("client"):
+            if (key == "client")
+                value.get_to(result.client);
+            break;
+        case keyHash("version"):
+            if (key == "version")
+                value.get_to(result.version);
+            break;
+        case keyHash("expires"):
+            if (key == "expires")
+                value.get_to(result.expires);
+            break;
+        case keyHash("ttl"):
+            if (key == "ttl")
+                value.get_to(result.ttl);
+            break;
+        case keyHash("data"):
+            if (key == "data") {
+                result.data = payloads
+                        ? std::string {payloads->at(value.template get<std::size_t>())}
+                        : value.dump();
+            }
+            break;
+        case keyHash("subs"):
+            if (key == "subs" && value.is_object()) {
+                for (auto sub = value.begin(); sub != value.end(); ++sub) {
+                    read(sub.value(), result.subs[sub.key()], payloads);
+                }
+            }
+            break;
+        case keyHash("ping"):
+            if (key == "ping")
+                value.get_to(result.ping);
+            break;
+        case keyHash("pong"):
+            if (key == "pong")
+                value.get_to(result.pong);
+            break;
+        case keyHash("session"):
+            if (key == "session")
+                value.get_to(result.session);
+            break;
+        case keyHash("node"):
+            if (key == "node")
+                value.get_to(result.node);
+            break;
+        case keyHash("time"):
+            if (key == "time")
+                value.get_to(result.time);
+            break;
+        }
+    }
+}
+
+template<typename J>
+auto read(J &j, RefreshResult &result) -> void
+{
+    if (!j.is_object())
+        return;
+
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        auto const &key = it.key();
+        auto &value = it.value();
+        switch (keyHash(key)) {
+        case keyHash("client"):
+            if (key == "client")
+                value.get_to(result.client);
+            break;
+        case keyHash("version"):
+            if (key == "version")
+                value.get_to(result.version);
+            break;
+        case keyHash("expires"):
+            if (key == "expires")
+                value.get_to(result.expires);
+            break;
+        case keyHash("ttl"):
+            if (key == "ttl")
+                value.get_to(result.ttl);
+            break;
+        }
+    }
+}
+
+template<typename J>
+auto read(J &j, ErrorReply &error) -> void
+{
+    if (!j.is_object())
+        return;
+
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        auto const &key = it.key();
+        auto &value = it.value();
+        switch (keyHash(key)) {
+        case keyHash("code"):
+            if (key == "code")
+                value.get_to(error.code);
+            break;
+        case keyHash("message"):
+            if (key == "message")
+                value.get_to(error.message);
+            break;
+        case keyHash("temporary"):
+            if (key == "temporary")
+                value.get_to(error.temporary);
+            break;
+        }
+    }
+}
+
+template<typename J>
+auto read(J &j, Reply &reply, Payloads const *payloads = nullptr) -> void
+{
+    if (!j.is_object())
+        return;
+
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        auto const &key = it.key();
+        auto &value = it.value();
+        switch (keyHash(key)) {
+        case keyHash("id"):
+            if (key == "id")
+                value.get_to(reply.id);
+            break;
+        case keyHash("error"):
+            if (key == "error")
+                read(value, reply.result.template emplace<ErrorReply>());
+            break;
+        case keyHash("push"):
+            if (key == "push")
+                read(value, reply.result.template emplace<Push>(), payloads);
+            break;
+        case keyHash("connect"):
+            if (key == "connect")
+                read(value, reply.result.template emplace<ConnectResult>(), payloads);
+            break;
+        case keyHash("subscribe"):
+            if (key == "subscribe")
+                read(value, reply.result.template emplace<SubscribeResult>(), payloads);
+            break;
+        case keyHash("publish"):
+            if (key == "publish")
+                reply.result.template emplace<PublishResult>();
+            break;
+        case keyHash("refresh"):
+            if (key == "refresh")
+                read(value, reply.result.template emplace<RefreshResult>());
+            break;
+        case keyHash("send"):
+            if (key == "send")
+                reply.result.template emplace<SendResult>();
+            break;
+        case keyHash("unsubscribe"):
+            if (key == "unsubscribe")
+                reply.result.template emplace<UnsubscribeResult>();
+            break;
+        }
+    }
+}
 
-    if (!req.token.empty())
-        j["token"] = req.token;
-    if (!req.data.empty())
-        j["data"] = req.data;
-    if (!req.version.empty())
-        j["version"] = req.version;
 }
 
 auto to_json(json &j, SubscribeRequest const &req) -> void
@@ -40,6 +685,20 @@ auto to_json(json &j, SubscribeRequest const &req) -> void
         j["delta"] = req.delta;
 }
 
+auto to_json(json &j, ConnectRequest const &req) -> void
+{
+    j = json {{"name", req.name}};
+
+    if (!req.token.empty())
+        j["token"] = req.token;
+    if (!req.data.empty())
+        j["data"] = req.data;
+    if (!req.version.empty())
+        j["version"] = req.version;
+    for (auto const &[channel, sub] : req.subs)
+        j["subs"][channel] = sub;
+}
+
 auto to_json(json &j, UnsubscribeRequest const &req) -> void
 {
     j = json {{"channel", req.channel}};
@@ -47,7 +706,11 @@ auto to_json(json &j, UnsubscribeRequest const &req) -> void
 
 auto to_json(json &j, PublishRequest const &req) -> void
 {
-    j = json {{"channel", req.channel}, {"data", req.data}};
+    auto data = req.data ? *req.data : json {};
+    if (!req.raw.empty()) {
+        data = json::parse(req.raw.view());
+    }
+    j = json {{"channel", req.channel}, {"data", std::move(data)}};
 }
 
 auto to_json(json &j, RefreshRequest const &req) -> void
@@ -60,56 +723,390 @@ auto to_json(json &j, SendRequest const &req) -> void
     j = json {{"data", req.data}};
 }
 
+auto to_json(json &j, Command const &cmd) -> void
+{
+    j["id"] = cmd.id;
+
+    std::visit(
+            [&j](auto const &req) {
+                if constexpr (std::is_same_v<std::decay_t<decltype(req)>, ConnectRequest>) {
+                    j["connect"] = req;
+                } else if constexpr (std::is_same_v<std::decay_t<decltype(req)>,
+                                                    SubscribeRequest>) {
+                    j["subscribe"] = req;
+                } else if constexpr (std::is_same_v<std::decay_t<decltype(req)>, PublishRequest>) {
+                    j["publish"] = req;
+                } else if constexpr (std::is_same_v<std::decay_t<decltype(req)>, RefreshRequest>) {
+                    j["refresh"] = req;
+                } else if constexpr (std::is_same_v<std::decay_t<decltype(req)>, SendRequest>) {
+                    j["send"] = req;
+                } else if constexpr (std::is_same_v<std::decay_t<decltype(req)>,
+                                                    UnsubscribeRequest>) {
+                    j["unsubscribe"] = req;
+                }
+            },
+            cmd.request);
+}
+
+namespace {
+
+// Length of the UTF-8 sequence at the front of text, 0 if it is malformed, overlong, a
+// surrogate or past U+10FFFF
+auto utf8Length(std::string_view text) -> std::size_t
+{
+    auto const lead = static_cast<unsigned char>(text[0]);
+    auto length = std::size_t {0};
+    auto min = 0x80u;
+    auto max = 0xBFu; // range of the second byte
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        length = 2;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        length = 3;
+        min = lead == 0xE0 ? 0xA0 : 0x80;
+        max = lead == 0xED ? 0x9F : 0xBF;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        length = 4;
+        min = lead == 0xF0 ? 0x90 : 0x80;
+        max = lead == 0xF4 ? 0x8F : 0xBF;
+    } else {
+        return 0;
+    }
+    if (text.size() < length) {
+        return 0;
+    }
+
+    for (auto i = std::size_t {1}; i < length; ++i) {
+        auto const c = static_cast<unsigned char>(text[i]);
+        if (c < (i == 1 ? min : 0x80u) || c > (i == 1 ? max : 0xBFu)) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+// Appends value as a JSON string. Like json::dump(), strings which aren't valid UTF-8 throw
+// json::type_error 316
+auto escapeJson(std::string_view value, std::string &out) -> void
+{
+    static constexpr char HEX[] = "0123456789abcdef";
+
+    out += '"';
+    auto plain = std::size_t {0};
+    for (auto i = std::size_t {0}; i < value.size(); ++i) {
+        auto const c = static_cast<unsigned char>(value[i]);
+        if (c >= 0x80) {
+            auto const length = utf8Length(value.substr(i));
+            if (length == 0) {
+                throw json::type_error::create(
+                        316, "invalid UTF-8 byte at index " + std::to_string(i), nullptr);
+            }
+            i += length - 1;
+            continue;
+        }
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        out.append(value.substr(plain, i - plain));
+        plain = i + 1;
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\b':
+            out += "\\b";
+            break;
+        case '\f':
+            out += "\\f";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            out += "\\u00";
+            out += HEX[c >> 4];
+            out += HEX[c & 0xF];
+        }
+    }
+    out.append(value.substr(plain));
+    out += '"';
+}
+
+template<typename Integer>
+auto writeInteger(Integer value, std::string &out) -> void
+{
+    char digits[20];
+    auto const [end, ec] = std::to_chars(std::begin(digits), std::end(digits), value);
+    out.append(digits, end);
+}
+
+// Like json::dump(): the fewest digits which read back as the same number, a ".0" for whole
+// ones and null for ones JSON has no notation for
+auto writeFloat(double value, std::string &out) -> void
+{
+    if (!std::isfinite(value)) {
+        out += "null";
+        return;
+    }
+
+    char digits[32];
+    auto length = 0;
+    for (auto precision = 15; precision <= 17; ++precision) {
+        length = std::snprintf(digits, sizeof(digits), "%.*g", precision, value);
+        if (std::strtod(digits, nullptr) == value) {
+            break;
+        }
+    }
+    // printf and strtod follow the locale, JSON always has a point
+    auto const number = std::string_view {digits, static_cast<std::size_t>(length)};
+    auto const point = *std::localeconv()->decimal_point;
+    auto const start = out.size();
+    out.append(number);
+    std::replace(out.begin() + static_cast<std::ptrdiff_t>(start), out.end(), point, '.');
+    if (std::string_view {out}.substr(start).find_first_of(".eE") == std::string_view::npos) {
+        out += ".0";
+    }
+}
+
+}
+
+auto dumpJson(json const &value, std::string &out) -> void
+{
+    // Written straight into out, json::dump() would build a string of its own for every value
+    switch (value.type()) {
+    case json::value_t::null:
+        out += "null";
+        break;
+    case json::value_t::boolean:
+        out += value.get<bool>() ? "true" : "false";
+        break;
+    case json::value_t::number_integer:
+        writeInteger(value.get<json::number_integer_t>(), out);
+        break;
+    case json::value_t::number_unsigned:
+        writeInteger(value.get<json::number_unsigned_t>(), out);
+        break;
+    case json::value_t::number_float:
+        writeFloat(value.get<json::number_float_t>(), out);
+        break;
+    case json::value_t::string:
+        escapeJson(value.get_ref<json::string_t const &>(), out);
+        break;
+    case json::value_t::array: {
+        out += '[';
+        for (auto it = value.begin(); it != value.end(); ++it) {
+            if (it != value.begin()) {
+                out += ',';
+            }
+            dumpJson(*it, out);
+        }
+        out += ']';
+        break;
+    }
+    case json::value_t::object: {
+        out += '{';
+        for (auto it = value.begin(); it != value.end(); ++it) {
+            if (it != value.begin()) {
+                out += ',';
+            }
+            escapeJson(it.key(), out);
+            out += ':';
+            dumpJson(it.value(), out);
+        }
+        out += '}';
+        break;
+    }
+    default:
+        // Binary and discarded values have no JSON of their own
+        out += value.dump();
+    }
+}
+
+namespace {
+
+// Writes JSON objects straight into an output string, member values are escaped as they go
+class JsonWriter
+{
+public:
+    explicit JsonWriter(std::string &out)
+        : out_ {out}
+    {
+    }
+
+    auto string(std::string_view name, std::string_view value) -> void
+    {
+        key(name);
+        escape(value);
+    }
+
+    auto uint(std::string_view name, std::uint64_t value) -> void
+    {
+        key(name);
+        writeInteger(value, out_);
+    }
+
+    auto boolean(std::string_view name, bool value) -> void
+    {
+        key(name);
+        out_ += value ? "true" : "false";
+    }
+
+    // Arbitrary user data, see dumpJson()
+    auto payload(std::string_view name, json const &value) -> void
+    {
+        key(name);
+        dumpJson(value, out_);
+    }
+
+    // value must be valid JSON, it is copied as is. Newlines in valid JSON can only be
+    // whitespace between tokens, they become spaces so they don't split the frame into lines.
+    auto raw(std::string_view name, std::string_view value) -> void
+    {
+        key(name);
+        auto const start = out_.size();
+        out_.append(value);
+        std::replace(out_.begin() + static_cast<std::ptrdiff_t>(start), out_.end(), '\n', ' ');
+    }
+
+    // Writes a nested object, its members are filled by func
+    template<typename F>
+    auto object(std::string_view name, F &&func) -> void
+    {
+        key(name);
+        JsonWriter {out_}.object(std::forward<F>(func));
+    }
+
+    template<typename F>
+    auto object(F &&func) -> void
+    {
+        out_ += '{';
+        func(*this);
+        out_ += '}';
+    }
+
+private:
+    auto key(std::string_view name) -> void
+    {
+        if (!first_) {
+            out_ += ',';
+        }
+        first_ = false;
+        escape(name);
+        out_ += ':';
+    }
+
+    auto escape(std::string_view value) -> void { escapeJson(value, out_); }
+
+    std::string &out_;
+    bool first_ {true};
+};
+
+// Members are written in the same cases as the to_json() overloads above
+auto writeRequest(JsonWriter &w, SubscribeRequest const &req) -> void
+{
+    w.string("channel", req.channel);
+    if (!req.token.empty())
+        w.string("token", req.token);
+    if (req.recover)
+        w.boolean("recover", req.recover);
+    if (!req.epoch.empty())
+        w.string("epoch", req.epoch);
+    if (req.offset != 0)
+        w.uint("offset", req.offset);
+    if (!req.data.empty())
+        w.payload("data", req.data);
+    if (req.positioned)
+        w.boolean("positioned", req.positioned);
+    if (req.recoverable)
+        w.boolean("recoverable", req.recoverable);
+    if (req.join_leave)
+        w.boolean("join_leave", req.join_leave);
+    if (!req.delta.empty())
+        w.string("delta", req.delta);
+}
+
+auto writeRequest(JsonWriter &w, ConnectRequest const &req) -> void
+{
+    w.string("name", req.name);
+    if (!req.token.empty())
+        w.string("token", req.token);
+    if (!req.data.empty())
+        w.string("data", req.data);
+    if (!req.version.empty())
+        w.string("version", req.version);
+    if (!req.subs.empty()) {
+        w.object("subs", [&req](JsonWriter &subs) {
+            for (auto const &[channel, sub] : req.subs) {
+                subs.object(channel, [&sub](JsonWriter &w) { writeRequest(w, sub); });
+            }
+        });
+    }
+}
+
+auto writeRequest(JsonWriter &w, UnsubscribeRequest const &req) -> void
+{
+    w.string("channel", req.channel);
+}
+
+auto writeRequest(JsonWriter &w, PublishRequest const &req) -> void
+{
+    w.string("channel", req.channel);
+    if (!req.raw.empty()) {
+        w.raw("data", req.raw.view());
+    } else {
+        // Both branches lvalues, so the payload isn't copied
+        static auto const null = json {};
+        w.payload("data", req.data ? *req.data : null);
+    }
+}
+
+auto writeRequest(JsonWriter &w, RefreshRequest const &req) -> void
+{
+    w.string("token", req.token);
+}
+
+auto writeRequest(JsonWriter &w, SendRequest const &req) -> void
+{
+    w.payload("data", req.data);
+}
+
+auto commandKey(Command::RequestType const &request) -> std::string_view
+{
+    static constexpr std::string_view KEYS[] = {"connect", "subscribe", "unsubscribe",
+                                                "publish", "refresh",   "send"};
+    static_assert(std::size(KEYS) == std::variant_size_v<Command::RequestType>);
+    return KEYS[request.index()];
+}
+
+}
+
+auto encodeJson(Command const &cmd, std::string &out) -> void
+{
+    JsonWriter {out}.object([&cmd](JsonWriter &w) {
+        w.uint("id", cmd.id);
+        w.object(commandKey(cmd.request), [&cmd](JsonWriter &w) {
+            std::visit([&w](auto const &req) { writeRequest(w, req); }, cmd.request);
+        });
+    });
+}
+
 auto from_json(json const &j, ConnectResult &result) -> void
 {
-    if (j.contains("client"))
-        j.at("client").get_to(result.client);
-    if (j.contains("version"))
-        j.at("version").get_to(result.version);
-    if (j.contains("expires"))
-        j.at("expires").get_to(result.expires);
-    if (j.contains("ttl"))
-        j.at("ttl").get_to(result.ttl);
-    if (j.contains("data"))
-        j.at("data").get_to(result.data.value());
-    if (j.contains("subs"))
-        j.at("subs").get_to(result.subs);
-    if (j.contains("ping"))
-        j.at("ping").get_to(result.ping);
-    if (j.contains("pong"))
-        j.at("pong").get_to(result.pong);
-    if (j.contains("session"))
-        j.at("session").get_to(result.session);
-    if (j.contains("node"))
-        j.at("node").get_to(result.node);
-    if (j.contains("time"))
-        j.at("time").get_to(result.time);
+    read(j, result);
 }
 
 auto from_json(json const &j, SubscribeResult &result) -> void
 {
-    if (j.contains("expires"))
-        j.at("expires").get_to(result.expires);
-    if (j.contains("ttl"))
-        j.at("ttl").get_to(result.ttl);
-    if (j.contains("recoverable"))
-        j.at("recoverable").get_to(result.recoverable);
-    if (j.contains("epoch"))
-        j.at("epoch").get_to(result.epoch);
-    if (j.contains("publications"))
-        j.at("publications").get_to(result.publications);
-    if (j.contains("recovered"))
-        j.at("recovered").get_to(result.recovered);
-    if (j.contains("offset"))
-        j.at("offset").get_to(result.offset);
-    if (j.contains("positioned"))
-        j.at("positioned").get_to(result.positioned);
-    if (j.contains("data"))
-        j.at("data").get_to(result.data);
-    if (j.contains("was_recovering"))
-        j.at("was_recovering").get_to(result.was_recovering);
-    if (j.contains("delta"))
-        j.at("delta").get_to(result.delta);
+    read(j, result);
 }
 
 auto from_json(json const &, UnsubscribeResult &) -> void
@@ -122,132 +1119,85 @@ auto from_json(json const &, PublishResult &) -> void
 
 auto from_json(json const &j, RefreshResult &result) -> void
 {
-    if (j.contains("client"))
-        j.at("client").get_to(result.client);
-    if (j.contains("version"))
-        j.at("version").get_to(result.version);
-    if (j.contains("expires"))
-        j.at("expires").get_to(result.expires);
-    if (j.contains("ttl"))
-        j.at("ttl").get_to(result.ttl);
+    read(j, result);
 }
 
 auto from_json(json const &, SendResult &) -> void
 {
 }
 
-auto to_json(json &j, Command const &cmd) -> void
+auto from_json(json const &j, ErrorReply &error) -> void
 {
-    j["id"] = cmd.id;
+    read(j, error);
+}
 
-    std::visit(
-            [&j](auto const &req) {
-                if constexpr (std::is_same_v<std::decay_t<decltype(req)>, ConnectRequest>) {
-                    j["connect"] = req;
-                } else if constexpr (std::is_same_v<std::decay_t<decltype(req)>,
-                                                    SubscribeRequest>) {
-                    j["subscribe"] = req;
-                } else if constexpr (std::is_same_v<std::decay_t<decltype(req)>, PublishRequest>) {
-                    j["publish"] = req;
-                } else if constexpr (std::is_same_v<std::decay_t<decltype(req)>, RefreshRequest>) {
-                    j["refresh"] = req;
-                } else if constexpr (std::is_same_v<std::decay_t<decltype(req)>, SendRequest>) {
-                    j["send"] = req;
-                } else if constexpr (std::is_same_v<std::decay_t<decltype(req)>,
-                                                    UnsubscribeRequest>) {
-                    j["unsubscribe"] = req;
-                }
-            },
-            cmd.request);
+auto from_json(json const &j, Reply &reply) -> void
+{
+    read(j, reply);
 }
 
-auto from_json(json const &j, ErrorReply &error) -> void
+#ifndef CENTRIFUGO_USE_SIMDJSON
+auto decodeReply(std::string_view message, bool lazyData) -> Reply
 {
-    if (j.contains("code"))
-        j.at("code").get_to(error.code);
-    if (j.contains("message"))
-        j.at("message").get_to(error.message);
-    if (j.contains("temporary"))
-        j.at("temporary").get_to(error.temporary);
+    auto reply = Reply {};
+    if (lazyData) {
+        auto payloads = Payloads {};
+        auto j = parseEnvelope(message, payloads);
+        read(j, reply, &payloads);
+        return reply;
+    }
+
+    // The DOM is private to this call, so publication payloads are moved out of it
+    auto j = json::parse(message.begin(), message.end());
+    read(j, reply);
+    return reply;
 }
+#endif
 
-auto from_json(json const &j, Reply &reply) -> void
+auto parsePayload(std::string_view bytes) -> json
 {
-    if (j.contains("id"))
-        j.at("id").get_to(reply.id);
+    auto data = json::parse(bytes.begin(), bytes.end(), nullptr, false);
+    if (data.is_discarded()) {
+        return json::binary({bytes.begin(), bytes.end()});
+    }
+    return data;
+}
 
-    if (j.contains("error")) {
-        reply.result = j.at("error").get<ErrorReply>();
-    } else if (j.contains("connect")) {
-        reply.result = j.at("connect").get<ConnectResult>();
-    } else if (j.contains("subscribe")) {
-        reply.result = j.at("subscribe").get<SubscribeResult>();
-    } else if (j.contains("publish")) {
-        reply.result = j.at("publish").get<PublishResult>();
-    } else if (j.contains("refresh")) {
-        reply.result = j.at("refresh").get<RefreshResult>();
-    } else if (j.contains("send")) {
-        reply.result = j.at("send").get<SendResult>();
-    } else if (j.contains("unsubscribe")) {
-        reply.result = j.at("unsubscribe").get<UnsubscribeResult>();
-    } else if (j.contains("push")) {
-        reply.result = j.at("push").get<Push>();
+auto Publication::payload() const -> json const &
+{
+    // rawData isn't touched here, only data needs the lock
+    if (rawData.empty()) {
+        return data;
+    }
+    auto const lock = std::lock_guard {payloadMutex_};
+    if (data.is_null()) {
+        data = parsePayload(rawData);
     }
+    return data;
 }
 
 auto from_json(json const &j, ClientInfo &info) -> void
 {
-    if (j.contains("user"))
-        j.at("user").get_to(info.user);
-    if (j.contains("client"))
-        j.at("client").get_to(info.client);
+    read(j, info);
 }
 
 auto from_json(json const &j, Publication &pub) -> void
 {
-    if (j.contains("offset"))
-        j.at("offset").get_to(pub.offset);
-    if (j.contains("data"))
-        j.at("data").get_to(pub.data);
-    if (j.contains("info"))
-        pub.info = j.at("info").get<ClientInfo>();
-    if (j.contains("tags"))
-        j.at("tags").get_to(pub.tags);
+    read(j, pub);
 }
 
 auto from_json(json const &j, Subscribe &sub) -> void
 {
-    if (j.contains("recoverable"))
-        j.at("recoverable").get_to(sub.recoverable);
-    if (j.contains("epoch"))
-        j.at("epoch").get_to(sub.epoch);
-    if (j.contains("offset"))
-        j.at("offset").get_to(sub.offset);
-    if (j.contains("positioned"))
-        j.at("positioned").get_to(sub.positioned);
-    // if (j.contains("data"))
-    //     j.at("data").get_to(sub.data);
+    read(j, sub);
 }
 
 auto from_json(json const &j, Unsubscribe &unsub) -> void
 {
-    if (j.contains("code"))
-        j.at("code").get_to(unsub.code);
-    if (j.contains("reason"))
-        j.at("reason").get_to(unsub.reason);
+    read(j, unsub);
 }
 
 auto from_json(json const &j, Push &push) -> void
 {
-    if (j.contains("channel"))
-        j.at("channel").get_to(push.channel);
-
-    if (j.contains("pub")) {
-        push.type = j.at("pub").get<Publication>();
-    } else if (j.contains("subscribe")) {
-        push.type = j.at("subscribe").get<Subscribe>();
-    } else if (j.contains("unsubscribe")) {
-        push.type = j.at("unsubscribe").get<Unsubscribe>();
-    }
+    read(j, push);
 }
 }
@@ -2,6 +2,7 @@
 
 #include <optional>
 #include <string>
+#include <string_view>
 #include <cstdint>
 #include <variant>
 #include <vector>
@@ -13,13 +14,6 @@
 
 namespace centrifugo {
 
-struct ConnectRequest {
-    std::string token;
-    std::string data;
-    std::string name;
-    std::string version;
-};
-
 struct SubscribeRequest {
     std::string channel;
     std::string token;
@@ -33,13 +27,27 @@ struct SubscribeRequest {
     std::string delta;
 };
 
+struct ConnectRequest {
+    std::string token;
+    std::string data;
+    std::string name;
+    std::string version;
+    // Subscriptions to restore within the connect round trip, by channel. Their results come
+    // back in ConnectResult::subs, channels the server leaves out have to subscribe on their own.
+    std::unordered_map<std::string, SubscribeRequest> subs;
+};
+
 struct UnsubscribeRequest {
     std::string channel;
 };
 
+// Publishes are encoded as they are queued, the request only borrows channel and data from
+// the caller
 struct PublishRequest {
-    std::string channel;
-    nlohmann::json data;
+    std::string_view channel;
+    nlohmann::json const *data {nullptr};
+    // Sent instead of data when set
+    RawJson raw;
 };
 
 struct RefreshRequest {
@@ -107,8 +115,16 @@ struct Unsubscribe {
     std::string reason;
 };
 
+struct Join {
+    ClientInfo info;
+};
+
+struct Leave {
+    ClientInfo info;
+};
+
 struct Push {
-    using PushType = std::variant<Publication, Subscribe, Unsubscribe>;
+    using PushType = std::variant<Publication, Subscribe, Unsubscribe, Join, Leave>;
 
     std::string channel;
     PushType type;
@@ -118,13 +134,15 @@ struct ErrorReply {
     std::uint32_t code {0};
     std::string message;
     bool temporary {false};
+    // Never sent by the server: the reply deadline of the command passed, its reply may still come
+    bool replyMayFollow {false};
 };
 
 struct Command {
     using RequestType = std::variant<ConnectRequest, SubscribeRequest, UnsubscribeRequest,
                                      PublishRequest, RefreshRequest, SendRequest>;
 
-    std::uint32_t id;
+    std::uint32_t id {0};
     RequestType request;
 };
 
@@ -132,7 +150,7 @@ struct Reply {
     using ResultType = std::variant<ConnectResult, SubscribeResult, UnsubscribeResult,
                                     PublishResult, RefreshResult, SendResult, Push, ErrorReply>;
 
-    std::uint32_t id;
+    std::uint32_t id {0};
     ResultType result;
 };
 
@@ -160,13 +178,30 @@ auto from_json(nlohmann::json const &j, ErrorReply &error) -> void;
 auto to_json(nlohmann::json &j, Command const &cmd) -> void;
 auto from_json(nlohmann::json const &j, Reply &reply) -> void;
 
-inline auto makeCommand(Command::RequestType &&req) -> Command
+// Appends value serialized to out the way json::dump() does, without a string of its own
+auto dumpJson(nlohmann::json const &value, std::string &out) -> void;
+
+// Appends cmd to out as a JSON object without building a nlohmann::json tree for it
+auto encodeJson(Command const &cmd, std::string &out) -> void;
+
+// Decodes a single JSON reply, message may point straight into the read buffer. Built with
+// CENTRIFUGO_USE_SIMDJSON it runs on simdjson's on-demand API instead of the nlohmann DOM.
+// With lazyData publication payloads are kept as raw bytes in Publication::rawData and only
+// parsed by Publication::payload().
+auto decodeReply(std::string_view message, bool lazyData = false) -> Reply;
+
+// Parses a raw payload, bytes which are not valid JSON become a binary JSON value
+auto parsePayload(std::string_view bytes) -> nlohmann::json;
+
+// FNV-1a hash the decoders switch over to dispatch object keys. Known keys of one object can't
+// collide, duplicate case labels wouldn't compile.
+constexpr auto keyHash(std::string_view key) -> std::uint32_t
 {
-    static auto commandId = 0u;
-    auto cmd = Command {};
-    cmd.id = ++commandId;
-    cmd.request = std::move(req);
-    return cmd;
+    auto hash = std::uint32_t {2166136261u};
+    for (auto const c : key) {
+        hash = (hash ^ static_cast<std::uint8_t>(c)) * 16777619u;
+    }
+    return hash;
 }
 
 }
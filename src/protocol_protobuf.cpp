@@ -0,0 +1,608 @@
+#include "protocol_protobuf.h"
+
+#include <stdexcept>
+
+namespace centrifugo::protobuf {
+
+using json = nlohmann::json;
+
+namespace {
+
+constexpr auto MAX_VARINT_BYTES = 10u;
+
+auto encodeVarint(std::uint64_t value, char *out) -> std::size_t
+{
+    auto size = std::size_t {0};
+    while (value >= 0x80) {
+        out[size++] = static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out[size++] = static_cast<char>(value);
+    return size;
+}
+
+// Binary JSON values are sent as raw bytes, everything else as serialized JSON
+auto writePayload(Writer &w, std::uint32_t field, json const &data) -> void
+{
+    if (data.is_null()) {
+        return;
+    }
+    if (data.is_binary()) {
+        auto const &bin = data.get_binary();
+        w.bytes(field, {reinterpret_cast<char const *>(bin.data()), bin.size()});
+        return;
+    }
+    thread_local auto dumped = std::string {};
+    dumped.clear();
+    dumpJson(data, dumped);
+    w.bytes(field, dumped);
+}
+
+auto writeRequest(Writer &w, SubscribeRequest const &req) -> void
+{
+    w.bytes(1, req.channel);
+    w.bytes(2, req.token);
+    w.boolean(3, req.recover);
+    w.bytes(6, req.epoch);
+    w.uint(7, req.offset);
+    if (!req.data.empty()) {
+        writePayload(w, 8, req.data);
+    }
+    w.boolean(9, req.positioned);
+    w.boolean(10, req.recoverable);
+    w.boolean(11, req.join_leave);
+    w.bytes(12, req.delta);
+}
+
+auto writeRequest(Writer &w, ConnectRequest const &req) -> void
+{
+    w.bytes(1, req.token);
+    w.bytes(2, req.data);
+    // map<string, SubscribeRequest>, an entry is a message of key 1 and value 2
+    for (auto const &[channel, sub] : req.subs) {
+        w.message(3, [&](Writer &entry) {
+            entry.bytes(1, channel);
+            entry.message(2, [&](Writer &value) { writeRequest(value, sub); });
+        });
+    }
+    w.bytes(4, req.name);
+    w.bytes(5, req.version);
+}
+
+auto writeRequest(Writer &w, UnsubscribeRequest const &req) -> void
+{
+    w.bytes(1, req.channel);
+}
+
+auto writeRequest(Writer &w, PublishRequest const &req) -> void
+{
+    w.bytes(1, req.channel);
+    if (!req.raw.empty()) {
+        w.bytes(2, req.raw.view());
+    } else if (req.data) {
+        writePayload(w, 2, *req.data);
+    }
+}
+
+auto writeRequest(Writer &w, RefreshRequest const &req) -> void
+{
+    w.bytes(1, req.token);
+}
+
+auto writeRequest(Writer &w, SendRequest const &req) -> void
+{
+    writePayload(w, 1, req.data);
+}
+
+auto commandField(Command::RequestType const &request) -> std::uint32_t
+{
+    return std::visit(
+            [](auto const &req) -> std::uint32_t {
+                using RequestType = std::decay_t<decltype(req)>;
+
+                if constexpr (std::is_same_v<RequestType, ConnectRequest>) {
+                    return 4;
+                } else if constexpr (std::is_same_v<RequestType, SubscribeRequest>) {
+                    return 5;
+                } else if constexpr (std::is_same_v<RequestType, UnsubscribeRequest>) {
+                    return 6;
+                } else if constexpr (std::is_same_v<RequestType, PublishRequest>) {
+                    return 7;
+                } else if constexpr (std::is_same_v<RequestType, SendRequest>) {
+                    return 12;
+                } else if constexpr (std::is_same_v<RequestType, RefreshRequest>) {
+                    return 14;
+                }
+            },
+            request);
+}
+
+auto read(std::string_view message, ClientInfo &info) -> void
+{
+    auto r = Reader {message};
+    while (r.next()) {
+        switch (r.field()) {
+        case 1:
+            info.user = r.bytes();
+            break;
+        case 2:
+            info.client = r.bytes();
+            break;
+        default:
+            r.skip();
+        }
+    }
+}
+
+auto readMapEntry(std::string_view message) -> std::pair<std::string_view, std::string_view>
+{
+    auto entry = std::pair<std::string_view, std::string_view> {};
+    auto r = Reader {message};
+    while (r.next()) {
+        switch (r.field()) {
+        case 1:
+            entry.first = r.bytes();
+            break;
+        case 2:
+            entry.second = r.bytes();
+            break;
+        default:
+            r.skip();
+        }
+    }
+    return entry;
+}
+
+auto read(std::string_view message, Publication &pub, bool lazyData) -> void
+{
+    auto r = Reader {message};
+    while (r.next()) {
+        switch (r.field()) {
+        case 4:
+            if (lazyData) {
+                pub.rawData = r.bytes();
+            } else {
+                pub.data = parsePayload(r.bytes());
+            }
+            break;
+        case 5:
+            read(r.bytes(), pub.info.emplace());
+            break;
+        case 6:
+            pub.offset = r.varint();
+            break;
+        case 7: {
+            auto const [key, value] = readMapEntry(r.bytes());
+            pub.tags.emplace(key, value);
+            break;
+        }
+        case 8:
+            pub.delta = r.boolean();
+            break;
+        default:
+            r.skip();
+        }
+    }
+}
+
+auto read(std::string_view message, SubscribeResult &result, bool lazyData) -> void
+{
+    auto r = Reader {message};
+    while (r.next()) {
+        switch (r.field()) {
+        case 1:
+            result.expires = r.boolean();
+            break;
+        case 2:
+            result.ttl = static_cast<std::uint32_t>(r.varint());
+            break;
+        case 3:
+            result.recoverable = r.boolean();
+            break;
+        case 6:
+            result.epoch = r.bytes();
+            break;
+        case 7:
+            read(r.bytes(), result.publications.emplace_back(), lazyData);
+            break;
+        case 8:
+            result.recovered = r.boolean();
+            break;
+        case 9:
+            result.offset = r.varint();
+            break;
+        case 10:
+            result.positioned = r.boolean();
+            break;
+        case 11: {
+            auto const data = r.bytes();
+            result.data.assign(data.begin(), data.end());
+            break;
+        }
+        case 12:
+            result.was_recovering = r.boolean();
+            break;
+        case 13:
+            result.delta = r.boolean();
+            break;
+        default:
+            r.skip();
+        }
+    }
+}
+
+auto read(std::string_view message, ConnectResult &result, bool lazyData) -> void
+{
+    auto r = Reader {message};
+    while (r.next()) {
+        switch (r.field()) {
+        case 1:
+            result.client = r.bytes();
+            break;
+        case 2:
+            result.version = r.bytes();
+            break;
+        case 3:
+            result.expires = r.boolean();
+            break;
+        case 4:
+            result.ttl = static_cast<std::uint32_t>(r.varint());
+            break;
+        case 5:
+            result.data = std::string {r.bytes()};
+            break;
+        case 6: {
+            auto const [channel, sub] = readMapEntry(r.bytes());
+            read(sub, result.subs[std::string {channel}], lazyData);
+            break;
+        }
+        case 7:
+            result.ping = static_cast<std::uint32_t>(r.varint());
+            break;
+        case 8:
+            result.pong = r.boolean();
+            break;
+        case 9:
+            result.session = r.bytes();
+            break;
+        case 10:
+            result.node = r.bytes();
+            break;
+        case 11:
+            result.time = static_cast<std::int64_t>(r.varint());
+            break;
+        default:
+            r.skip();
+        }
+    }
+}
+
+auto read(std::string_view message, RefreshResult &result) -> void
+{
+    auto r = Reader {message};
+    while (r.next()) {
+        switch (r.field()) {
+        case 1:
+            result.client = r.bytes();
+            break;
+        case 2:
+            result.version = r.bytes();
+            break;
+        case 3:
+            result.expires = r.boolean();
+            break;
+        case 4:
+            result.ttl = static_cast<std::uint32_t>(r.varint());
+            break;
+        default:
+            r.skip();
+        }
+    }
+}
+
+auto read(std::string_view message, ErrorReply &error) -> void
+{
+    auto r = Reader {message};
+    while (r.next()) {
+        switch (r.field()) {
+        case 1:
+            error.code = static_cast<std::uint32_t>(r.varint());
+            break;
+        case 2:
+            error.message = r.bytes();
+            break;
+        case 3:
+            error.temporary = r.boolean();
+            break;
+        default:
+            r.skip();
+        }
+    }
+}
+
+auto read(std::string_view message, Subscribe &sub) -> void
+{
+    auto r = Reader {message};
+    while (r.next()) {
+        switch (r.field()) {
+        case 1:
+            sub.recoverable = r.boolean();
+            break;
+        case 4:
+            sub.epoch = r.bytes();
+            break;
+        case 5:
+            sub.offset = r.varint();
+            break;
+        case 6:
+            sub.positioned = r.boolean();
+            break;
+        default:
+            r.skip();
+        }
+    }
+}
+
+auto read(std::string_view message, Unsubscribe &unsub) -> void
+{
+    auto r = Reader {message};
+    while (r.next()) {
+        switch (r.field()) {
+        case 2:
+            unsub.code = static_cast<std::uint32_t>(r.varint());
+            break;
+        case 3:
+            unsub.reason = r.bytes();
+            break;
+        default:
+            r.skip();
+        }
+    }
+}
+
+// Join and Leave only carry the info of the client
+template<typename Presence>
+auto readPresence(std::string_view message, Presence &presence) -> void
+{
+    auto r = Reader {message};
+    while (r.next()) {
+        switch (r.field()) {
+        case 1:
+            read(r.bytes(), presence.info);
+            break;
+        default:
+            r.skip();
+        }
+    }
+}
+
+auto read(std::string_view message, Push &push, bool lazyData) -> void
+{
+    auto r = Reader {message};
+    while (r.next()) {
+        switch (r.field()) {
+        case 2:
+            push.channel = r.bytes();
+            break;
+        case 4:
+            read(r.bytes(), push.type.emplace<Publication>(), lazyData);
+            break;
+        case 5:
+            readPresence(r.bytes(), push.type.emplace<Join>());
+            break;
+        case 6:
+            readPresence(r.bytes(), push.type.emplace<Leave>());
+            break;
+        case 7:
+            read(r.bytes(), push.type.emplace<Unsubscribe>());
+            break;
+        case 9:
+            read(r.bytes(), push.type.emplace<Subscribe>());
+            break;
+        default:
+            r.skip();
+        }
+    }
+}
+
+}
+
+Writer::Writer(std::string &out)
+    : out_ {out}
+{
+}
+
+auto Writer::varint(std::uint64_t value) -> void
+{
+    char buf[MAX_VARINT_BYTES];
+    out_.append(buf, encodeVarint(value, buf));
+}
+
+auto Writer::tag(std::uint32_t field, WireType type) -> void
+{
+    varint((static_cast<std::uint64_t>(field) << 3) | static_cast<std::uint8_t>(type));
+}
+
+auto Writer::uint(std::uint32_t field, std::uint64_t value) -> void
+{
+    if (value == 0) {
+        return;
+    }
+    tag(field, WireType::Varint);
+    varint(value);
+}
+
+auto Writer::boolean(std::uint32_t field, bool value) -> void
+{
+    uint(field, value ? 1 : 0);
+}
+
+auto Writer::bytes(std::uint32_t field, std::string_view value) -> void
+{
+    if (value.empty()) {
+        return;
+    }
+    tag(field, WireType::LengthDelimited);
+    varint(value.size());
+    out_.append(value);
+}
+
+auto Writer::prefixLength(std::size_t start) -> void
+{
+    char buf[MAX_VARINT_BYTES];
+    auto const size = encodeVarint(out_.size() - start, buf);
+    out_.insert(start, buf, size);
+}
+
+Reader::Reader(std::string_view in)
+    : in_ {in}
+{
+}
+
+auto Reader::next() -> bool
+{
+    if (in_.empty()) {
+        return false;
+    }
+
+    auto const key = varint();
+    field_ = static_cast<std::uint32_t>(key >> 3);
+    type_ = static_cast<WireType>(key & 0x07);
+    return true;
+}
+
+auto Reader::varint() -> std::uint64_t
+{
+    auto value = std::uint64_t {0};
+    for (auto shift = 0u; shift < 7 * MAX_VARINT_BYTES; shift += 7) {
+        if (in_.empty()) {
+            throw std::runtime_error {"protobuf: truncated varint"};
+        }
+        auto const byte = static_cast<std::uint8_t>(in_.front());
+        in_.remove_prefix(1);
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    throw std::runtime_error {"protobuf: malformed varint"};
+}
+
+auto Reader::bytes() -> std::string_view
+{
+    if (type_ != WireType::LengthDelimited) {
+        throw std::runtime_error {"protobuf: unexpected wire type for field "
+                                  + std::to_string(field_)};
+    }
+
+    auto const size = varint();
+    if (size > in_.size()) {
+        throw std::runtime_error {"protobuf: truncated field " + std::to_string(field_)};
+    }
+
+    auto const value = in_.substr(0, size);
+    in_.remove_prefix(size);
+    return value;
+}
+
+auto Reader::skip() -> void
+{
+    auto drop = [this](std::size_t size) {
+        if (size > in_.size()) {
+            throw std::runtime_error {"protobuf: truncated field " + std::to_string(field_)};
+        }
+        in_.remove_prefix(size);
+    };
+
+    switch (type_) {
+    case WireType::Varint:
+        varint();
+        break;
+    case WireType::Fixed64:
+        drop(8);
+        break;
+    case WireType::LengthDelimited:
+        bytes();
+        break;
+    case WireType::Fixed32:
+        drop(4);
+        break;
+    default:
+        throw std::runtime_error {"protobuf: unsupported wire type for field "
+                                  + std::to_string(field_)};
+    }
+}
+
+auto readDelimited(std::string_view &in) -> std::optional<std::string_view>
+{
+    if (in.empty()) {
+        return std::nullopt;
+    }
+
+    auto r = Reader {in};
+    auto const size = r.varint();
+    auto const rest = r.remaining();
+    if (size > rest.size()) {
+        throw std::runtime_error {"protobuf: truncated frame"};
+    }
+
+    in = rest.substr(size);
+    return rest.substr(0, size);
+}
+
+auto encode(Command const &cmd, std::string &out) -> void
+{
+    auto w = Writer {out};
+    w.delimited([&cmd](Writer &w) {
+        w.uint(1, cmd.id);
+        w.message(commandField(cmd.request), [&cmd](Writer &w) {
+            std::visit([&w](auto const &req) { writeRequest(w, req); }, cmd.request);
+        });
+    });
+}
+
+auto encodePong(std::string &out) -> void
+{
+    Writer {out}.varint(0);
+}
+
+auto decode(std::string_view message, bool lazyData) -> Reply
+{
+    auto reply = Reply {};
+    auto r = Reader {message};
+    while (r.next()) {
+        switch (r.field()) {
+        case 1:
+            reply.id = static_cast<std::uint32_t>(r.varint());
+            break;
+        case 2:
+            read(r.bytes(), reply.result.emplace<ErrorReply>());
+            break;
+        case 4:
+            read(r.bytes(), reply.result.emplace<Push>(), lazyData);
+            break;
+        case 5:
+            read(r.bytes(), reply.result.emplace<ConnectResult>(), lazyData);
+            break;
+        case 6:
+            read(r.bytes(), reply.result.emplace<SubscribeResult>(), lazyData);
+            break;
+        case 7:
+            r.bytes();
+            reply.result.emplace<UnsubscribeResult>();
+            break;
+        case 8:
+            r.bytes();
+            reply.result.emplace<PublishResult>();
+            break;
+        case 14:
+            read(r.bytes(), reply.result.emplace<RefreshResult>());
+            break;
+        default:
+            r.skip();
+        }
+    }
+    return reply;
+}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "protocol_all.h"
+
+// Protobuf wire format of the Centrifugo client protocol, see
+// https://github.com/centrifugal/protocol/blob/master/definitions/client.proto
+// Messages are encoded by hand, so no libprotobuf/protoc is needed.
+namespace centrifugo::protobuf {
+
+enum class WireType : std::uint8_t { Varint = 0, Fixed64 = 1, LengthDelimited = 2, Fixed32 = 5 };
+
+class Writer
+{
+public:
+    explicit Writer(std::string &out);
+
+    auto varint(std::uint64_t value) -> void;
+    auto tag(std::uint32_t field, WireType type) -> void;
+
+    // Scalar fields are skipped when they hold the default value, like proto3 does
+    auto uint(std::uint32_t field, std::uint64_t value) -> void;
+    auto boolean(std::uint32_t field, bool value) -> void;
+    auto bytes(std::uint32_t field, std::string_view value) -> void;
+
+    // Writes a length-delimited nested message, body is filled by func
+    template<typename F>
+    auto message(std::uint32_t field, F &&func) -> void
+    {
+        tag(field, WireType::LengthDelimited);
+        delimited(std::forward<F>(func));
+    }
+
+    // Writes body prefixed with its varint length
+    template<typename F>
+    auto delimited(F &&func) -> void
+    {
+        auto const start = out_.size();
+        func(*this);
+        prefixLength(start);
+    }
+
+private:
+    auto prefixLength(std::size_t start) -> void;
+
+    std::string &out_;
+};
+
+class Reader
+{
+public:
+    explicit Reader(std::string_view in);
+
+    auto remaining() const -> std::string_view { return in_; }
+
+    // Reads the next field key, returns false at the end of the message
+    auto next() -> bool;
+    auto field() const -> std::uint32_t { return field_; }
+
+    auto varint() -> std::uint64_t;
+    auto boolean() -> bool { return varint() != 0; }
+    auto bytes() -> std::string_view;
+    auto skip() -> void;
+
+private:
+    std::string_view in_;
+    std::uint32_t field_ {0};
+    WireType type_ {WireType::Varint};
+};
+
+// Reads one varint length-delimited message from the front of in and advances in past it.
+// Returns std::nullopt when in is empty.
+auto readDelimited(std::string_view &in) -> std::optional<std::string_view>;
+
+// Appends cmd to out as a varint length-delimited Command message
+auto encode(Command const &cmd, std::string &out) -> void;
+
+// Appends an empty Command, which is how a client answers a server ping
+auto encodePong(std::string &out) -> void;
+
+// Decodes a single Reply message (without its length prefix), see decodeReply() for lazyData
+auto decode(std::string_view message, bool lazyData = false) -> Reply;
+
+}
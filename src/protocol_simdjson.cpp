@@ -0,0 +1,429 @@
+#ifdef CENTRIFUGO_USE_SIMDJSON
+
+#    include "protocol_all.h"
+
+#    include <cctype>
+
+#    include <simdjson.h>
+
+// decodeReply() on top of simdjson's on-demand API: the reply is walked straight off the
+// structural index, only publication payloads end up in a nlohmann::json value.
+namespace centrifugo {
+
+namespace od = simdjson::ondemand;
+using json = nlohmann::json;
+
+namespace {
+
+auto isObject(od::value &value) -> bool
+{
+    return value.type() == od::json_type::object;
+}
+
+auto toString(od::value &value) -> std::string
+{
+    return std::string {std::string_view {value.get_string()}};
+}
+
+// raw_json() of a scalar may carry the whitespace following it
+auto rawJson(od::value &value) -> std::string_view
+{
+    auto raw = std::string_view {value.raw_json()};
+    while (!raw.empty() && std::isspace(static_cast<unsigned char>(raw.back()))) {
+        raw.remove_suffix(1);
+    }
+    return raw;
+}
+
+auto toPayload(od::value &value) -> json
+{
+    auto const raw = rawJson(value);
+    return json::parse(raw.begin(), raw.end());
+}
+
+auto read(od::object object, ClientInfo &info) -> void
+{
+    for (auto member : object) {
+        auto const key = std::string_view {member.unescaped_key()};
+        auto value = od::value {member.value()};
+        switch (keyHash(key)) {
+        case keyHash("user"):
+            if (key == "user")
+                info.user = toString(value);
+            break;
+        case keyHash("client"):
+            if (key == "client")
+                info.client = toString(value);
+            break;
+        }
+    }
+}
+
+auto read(od::object object, Publication &pub, bool lazyData) -> void
+{
+    for (auto member : object) {
+        auto const key = std::string_view {member.unescaped_key()};
+        auto value = od::value {member.value()};
+        switch (keyHash(key)) {
+        case keyHash("offset"):
+            if (key == "offset")
+                pub.offset = value.get_uint64();
+            break;
+        case keyHash("data"):
+            if (key == "data") {
+                if (lazyData) {
+                    pub.rawData = rawJson(value);
+                } else {
+                    pub.data = toPayload(value);
+                }
+            }
+            break;
+        case keyHash("info"):
+            if (key == "info" && isObject(value))
+                read(value.get_object(), pub.info.emplace());
+            break;
+        case keyHash("tags"):
+            if (key == "tags" && isObject(value)) {
+                for (auto tag : value.get_object()) {
+                    auto const name = std::string {std::string_view {tag.unescaped_key()}};
+                    auto tagValue = od::value {tag.value()};
+                    pub.tags.emplace(name, toString(tagValue));
+                }
+            }
+            break;
+        case keyHash("delta"):
+            if (key == "delta")
+                pub.delta = value.get_bool();
+            break;
+        }
+    }
+}
+
+auto read(od::object object, Subscribe &sub) -> void
+{
+    for (auto member : object) {
+        auto const key = std::string_view {member.unescaped_key()};
+        auto value = od::value {member.value()};
+        switch (keyHash(key)) {
+        case keyHash("recoverable"):
+            if (key == "recoverable")
+                sub.recoverable = value.get_bool();
+            break;
+        case keyHash("epoch"):
+            if (key == "epoch")
+                sub.epoch = toString(value);
+            break;
+        case keyHash("offset"):
+            if (key == "offset")
+                sub.offset = value.get_uint64();
+            break;
+        case keyHash("positioned"):
+            if (key == "positioned")
+                sub.positioned = value.get_bool();
+            break;
+        }
+    }
+}
+
+auto read(od::object object, Unsubscribe &unsub) -> void
+{
+    for (auto member : object) {
+        auto const key = std::string_view {member.unescaped_key()};
+        auto value = od::value {member.value()};
+        switch (keyHash(key)) {
+        case keyHash("code"):
+            if (key == "code")
+                unsub.code = static_cast<std::uint32_t>(value.get_uint64());
+            break;
+        case keyHash("reason"):
+            if (key == "reason")
+                unsub.reason = toString(value);
+            break;
+        }
+    }
+}
+
+// Join and Leave only carry the info of the client
+template<typename Presence>
+auto readPresence(od::object object, Presence &presence) -> void
+{
+    for (auto member : object) {
+        auto const key = std::string_view {member.unescaped_key()};
+        auto value = od::value {member.value()};
+        if (key == "info" && isObject(value)) {
+            read(value.get_object(), presence.info);
+        }
+    }
+}
+
+auto read(od::object object, Push &push, bool lazyData) -> void
+{
+    for (auto member : object) {
+        auto const key = std::string_view {member.unescaped_key()};
+        auto value = od::value {member.value()};
+        switch (keyHash(key)) {
+        case keyHash("channel"):
+            if (key == "channel")
+                push.channel = toString(value);
+            break;
+        case keyHash("pub"):
+            if (key == "pub" && isObject(value))
+                read(value.get_object(), push.type.emplace<Publication>(), lazyData);
+            break;
+        case keyHash("subscribe"):
+            if (key == "subscribe" && isObject(value))
+                read(value.get_object(), push.type.emplace<Subscribe>());
+            break;
+        case keyHash("unsubscribe"):
+            if (key == "unsubscribe" && isObject(value))
+                read(value.get_object(), push.type.emplace<Unsubscribe>());
+            break;
+        case keyHash("join"):
+            if (key == "join" && isObject(value))
+                readPresence(value.get_object(), push.type.emplace<Join>());
+            break;
+        case keyHash("leave"):
+            if (key == "leave" && isObject(value))
+                readPresence(value.get_object(), push.type.emplace<Leave>());
+            break;
+        }
+    }
+}
+
+auto read(od::object object, SubscribeResult &result, bool lazyData) -> void
+{
+    for (auto member : object) {
+        auto const key = std::string_view {member.unescaped_key()};
+        auto value = od::value {member.value()};
+        switch (keyHash(key)) {
+        case keyHash("expires"):
+            if (key == "expires")
+                result.expires = value.get_bool();
+            break;
+        case keyHash("ttl"):
+            if (key == "ttl")
+                result.ttl = static_cast<std::uint32_t>(value.get_uint64());
+            break;
+        case keyHash("recoverable"):
+            if (key == "recoverable")
+                result.recoverable = value.get_bool();
+            break;
+        case keyHash("epoch"):
+            if (key == "epoch")
+                result.epoch = toString(value);
+            break;
+        case keyHash("publications"):
+            if (key == "publications") {
+                for (auto element : value.get_array()) {
+                    auto pub = od::value {element};
+                    if (isObject(pub)) {
+                        read(pub.get_object(), result.publications.emplace_back(), lazyData);
+                    }
+                }
+            }
+            break;
+        case keyHash("recovered"):
+            if (key == "recovered")
+                result.recovered = value.get_bool();
+            break;
+        case keyHash("offset"):
+            if (key == "offset")
+                result.offset = value.get_uint64();
+            break;
+        case keyHash("positioned"):
+            if (key == "positioned")
+                result.positioned = value.get_bool();
+            break;
+        case keyHash("data"):
+            if (key == "data") {
+                auto const raw = rawJson(value);
+                result.data.assign(raw.begin(), raw.end());
+            }
+            break;
+        case keyHash("was_recovering"):
+            if (key == "was_recovering")
+                result.was_recovering = value.get_bool();
+            break;
+        case keyHash("delta"):
+            if (key == "delta")
+                result.delta = value.get_bool();
+            break;
+        }
+    }
+}
+
+auto read(od::object object, ConnectResult &result, bool lazyData) -> void
+{
+    for (auto member : object) {
+        auto const key = std::string_view {member.unescaped_key()};
+        auto value = od::value {member.value()};
+        switch (keyHash(key)) {
+        case keyHash("client"):
+            if (key == "client")
+                result.client = toString(value);
+            break;
+        case keyHash("version"):
+            if (key == "version")
+                result.version = toString(value);
+            break;
+        case keyHash("expires"):
+            if (key == "expires")
+                result.expires = value.get_bool();
+            break;
+        case keyHash("ttl"):
+            if (key == "ttl")
+                result.ttl = static_cast<std::uint32_t>(value.get_uint64());
+            break;
+        case keyHash("data"):
+            if (key == "data")
+                result.data = std::string {rawJson(value)};
+            break;
+        case keyHash("subs"):
+            if (key == "subs" && isObject(value)) {
+                for (auto sub : value.get_object()) {
+                    auto const channel = std::string {std::string_view {sub.unescaped_key()}};
+                    auto subValue = od::value {sub.value()};
+                    if (isObject(subValue)) {
+                        read(subValue.get_object(), result.subs[channel], lazyData);
+                    }
+                }
+            }
+            break;
+        case keyHash("ping"):
+            if (key == "ping")
+                result.ping = static_cast<std::uint32_t>(value.get_uint64());
+            break;
+        case keyHash("pong"):
+            if (key == "pong")
+                result.pong = value.get_bool();
+            break;
+        case keyHash("session"):
+            if (key == "session")
+                result.session = toString(value);
+            break;
+        case keyHash("node"):
+            if (key == "node")
+                result.node = toString(value);
+            break;
+        case keyHash("time"):
+            if (key == "time")
+                result.time = value.get_int64();
+            break;
+        }
+    }
+}
+
+auto read(od::object object, RefreshResult &result) -> void
+{
+    for (auto member : object) {
+        auto const key = std::string_view {member.unescaped_key()};
+        auto value = od::value {member.value()};
+        switch (keyHash(key)) {
+        case keyHash("client"):
+            if (key == "client")
+                result.client = toString(value);
+            break;
+        case keyHash("version"):
+            if (key == "version")
+                result.version = toString(value);
+            break;
+        case keyHash("expires"):
+            if (key == "expires")
+                result.expires = value.get_bool();
+            break;
+        case keyHash("ttl"):
+            if (key == "ttl")
+                result.ttl = static_cast<std::uint32_t>(value.get_uint64());
+            break;
+        }
+    }
+}
+
+auto read(od::object object, ErrorReply &error) -> void
+{
+    for (auto member : object) {
+        auto const key = std::string_view {member.unescaped_key()};
+        auto value = od::value {member.value()};
+        switch (keyHash(key)) {
+        case keyHash("code"):
+            if (key == "code")
+                error.code = static_cast<std::uint32_t>(value.get_uint64());
+            break;
+        case keyHash("message"):
+            if (key == "message")
+                error.message = toString(value);
+            break;
+        case keyHash("temporary"):
+            if (key == "temporary")
+                error.temporary = value.get_bool();
+            break;
+        }
+    }
+}
+
+auto read(od::object object, Reply &reply, bool lazyData) -> void
+{
+    for (auto member : object) {
+        auto const key = std::string_view {member.unescaped_key()};
+        auto value = od::value {member.value()};
+        switch (keyHash(key)) {
+        case keyHash("id"):
+            if (key == "id")
+                reply.id = static_cast<std::uint32_t>(value.get_uint64());
+            break;
+        case keyHash("error"):
+            if (key == "error" && isObject(value))
+                read(value.get_object(), reply.result.emplace<ErrorReply>());
+            break;
+        case keyHash("push"):
+            if (key == "push" && isObject(value))
+                read(value.get_object(), reply.result.emplace<Push>(), lazyData);
+            break;
+        case keyHash("connect"):
+            if (key == "connect" && isObject(value))
+                read(value.get_object(), reply.result.emplace<ConnectResult>(), lazyData);
+            break;
+        case keyHash("subscribe"):
+            if (key == "subscribe" && isObject(value))
+                read(value.get_object(), reply.result.emplace<SubscribeResult>(), lazyData);
+            break;
+        case keyHash("publish"):
+            if (key == "publish")
+                reply.result.emplace<PublishResult>();
+            break;
+        case keyHash("refresh"):
+            if (key == "refresh" && isObject(value))
+                read(value.get_object(), reply.result.emplace<RefreshResult>());
+            break;
+        case keyHash("send"):
+            if (key == "send")
+                reply.result.emplace<SendResult>();
+            break;
+        case keyHash("unsubscribe"):
+            if (key == "unsubscribe")
+                reply.result.emplace<UnsubscribeResult>();
+            break;
+        }
+    }
+}
+
+}
+
+auto decodeReply(std::string_view message, bool lazyData) -> Reply
+{
+    // simdjson reads past the end of the input, so the message is copied into a padded buffer
+    // reused across calls; the parser keeps its structural index allocation the same way.
+    thread_local auto parser = od::parser {};
+    thread_local auto padded = std::string {};
+    padded.assign(message);
+    padded.append(simdjson::SIMDJSON_PADDING, '\0');
+
+    auto doc = parser.iterate(padded.data(), message.size(), padded.size());
+    auto reply = Reply {};
+    read(doc.get_object(), reply, lazyData);
+    return reply;
+}
+
+}
+
+#endif
@@ -0,0 +1,93 @@
+#include "reply_routes.h"
+
+#include <algorithm>
+
+#include "inflight_commands.h"
+
+namespace centrifugo {
+
+auto ReplyRoutes::add(std::uint32_t id, Owner owner) -> void
+{
+    // A command whose reply never comes can't keep the routes growing, like in InFlightCommands
+    while (head_ < routes_.size() && id - routes_[head_].id >= InFlightCommands::MAX_SPAN
+           && routes_[head_].id < id) {
+        if (routes_[head_].live) {
+            routes_[head_].live = false;
+            routes_[head_].owner.reset();
+            --live_;
+        }
+        ++head_;
+    }
+    release();
+
+    // Ids are queued in increasing order, a command queued while another one was being sent
+    // may get its route first
+    auto route = Route {id, std::move(owner), true};
+    if (routes_.empty() || routes_.back().id < id) {
+        routes_.push_back(std::move(route));
+    } else {
+        auto const position = std::lower_bound(
+                routes_.begin() + static_cast<std::ptrdiff_t>(head_), routes_.end(), id,
+                [](Route const &route, std::uint32_t id) { return route.id < id; });
+        routes_.insert(position, std::move(route));
+    }
+    ++live_;
+}
+
+auto ReplyRoutes::find(std::uint32_t id) const -> std::shared_ptr<SubscriptionImpl *>
+{
+    if (auto const route = locate(id); route != routes_.end()) {
+        return route->owner.lock();
+    }
+    return nullptr;
+}
+
+auto ReplyRoutes::remove(std::uint32_t id) -> void
+{
+    auto const route = locate(id);
+    if (route == routes_.end()) {
+        return;
+    }
+
+    auto &removed = routes_[static_cast<std::size_t>(route - routes_.begin())];
+    removed.live = false;
+    removed.owner.reset();
+    --live_;
+    release();
+}
+
+auto ReplyRoutes::clear() -> void
+{
+    routes_.clear();
+    head_ = 0;
+    live_ = 0;
+}
+
+auto ReplyRoutes::locate(std::uint32_t id) const -> std::vector<Route>::const_iterator
+{
+    auto const route = std::lower_bound(
+            routes_.begin() + static_cast<std::ptrdiff_t>(head_), routes_.end(), id,
+            [](Route const &route, std::uint32_t id) { return route.id < id; });
+    if (route == routes_.end() || route->id != id || !route->live) {
+        return routes_.end();
+    }
+    return route;
+}
+
+auto ReplyRoutes::release() -> void
+{
+    while (head_ < routes_.size() && !routes_[head_].live) {
+        ++head_;
+    }
+
+    // Removed routes are erased in bulk, erasing keeps the capacity
+    if (head_ == routes_.size()) {
+        routes_.clear();
+        head_ = 0;
+    } else if (head_ > routes_.size() / 2) {
+        routes_.erase(routes_.begin(), routes_.begin() + static_cast<std::ptrdiff_t>(head_));
+        head_ = 0;
+    }
+}
+
+}
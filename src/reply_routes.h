@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace centrifugo {
+
+class SubscriptionImpl;
+
+// Subscriptions waiting for the replies to their commands, by command id. Routes sit in id
+// order in a vector which keeps its capacity, so recording one doesn't allocate once warmed up.
+// A subscription is held weakly, replies to one which is gone have no route.
+class ReplyRoutes
+{
+public:
+    using Owner = std::weak_ptr<SubscriptionImpl *>;
+
+    auto add(std::uint32_t id, Owner owner) -> void;
+    // Subscription of the command id, empty if it has none or it is gone
+    auto find(std::uint32_t id) const -> std::shared_ptr<SubscriptionImpl *>;
+    auto remove(std::uint32_t id) -> void;
+    auto clear() -> void;
+
+    auto size() const -> std::size_t { return live_; }
+
+private:
+    struct Route {
+        std::uint32_t id {0};
+        Owner owner;
+        bool live {false};
+    };
+
+    auto locate(std::uint32_t id) const -> std::vector<Route>::const_iterator;
+    auto release() -> void;
+
+    // Routes before head_ are removed ones waiting to be erased in bulk
+    std::vector<Route> routes_;
+    std::size_t head_ {0};
+    std::size_t live_ {0};
+};
+
+}
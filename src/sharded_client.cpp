@@ -0,0 +1,373 @@
+#include <centrifugo/sharded_client.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+
+#include <boost/asio/executor_work_guard.hpp>
+
+#ifdef __linux__
+#    include <pthread.h>
+#    include <sched.h>
+#endif
+
+namespace centrifugo {
+
+namespace {
+
+// FNV-1a with a final mix, stable across platforms and runs unlike std::hash
+auto ringHash(std::string_view key) -> std::uint64_t
+{
+    auto hash = std::uint64_t {14695981039346656037ull};
+    for (auto const c : key) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+auto pinThread(std::thread &thread, int cpu) -> bool
+{
+#ifdef __linux__
+    auto set = cpu_set_t {};
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+    (void)thread;
+    (void)cpu;
+    return true;
+#endif
+}
+
+struct Shard {
+    net::io_context io {1};
+    net::executor_work_guard<net::io_context::executor_type> work {io.get_executor()};
+    ShardedClient::Executor strand {net::make_strand(io)};
+    std::optional<Client> client;
+    std::thread thread;
+};
+
+}
+
+class ShardedClient::Impl
+{
+public:
+    Impl(std::string const &url, ClientConfig const &config, ShardingConfig const &sharding)
+    {
+        auto const count = std::max<std::size_t>(sharding.shards, 1);
+        auto const nodes = std::max<std::size_t>(sharding.virtualNodes, 1);
+        shards_.reserve(count);
+        ring_.reserve(count * nodes);
+
+        for (auto i = std::size_t {0}; i < count; ++i) {
+            auto &shard = *shards_.emplace_back(std::make_unique<Shard>());
+            shard.client.emplace(shard.strand, url, config);
+            shard.thread = std::thread {[&io = shard.io] { io.run(); }};
+
+            if (i < sharding.cpuAffinity.size() && sharding.cpuAffinity[i] >= 0
+                && !pinThread(shard.thread, sharding.cpuAffinity[i]) && config.logHandler) {
+                config.logHandler({LogLevel::Error,
+                                   "cannot pin shard thread",
+                                   {{"shard", i}, {"cpu", sharding.cpuAffinity[i]}}});
+            }
+
+            for (auto node = std::size_t {0}; node < nodes; ++node) {
+                ring_.emplace_back(ringHash(std::to_string(i) + '#' + std::to_string(node)), i);
+            }
+        }
+        std::sort(ring_.begin(), ring_.end());
+    }
+
+    ~Impl()
+    {
+        for (auto &shard : shards_) {
+            shard->work.reset();
+            shard->io.stop();
+        }
+        // Clients go before their io_context, with its thread gone none of their handlers run
+        for (auto &shard : shards_) {
+            shard->thread.join();
+            shard->client.reset();
+        }
+    }
+
+    auto shards() const -> std::size_t { return shards_.size(); }
+
+    // The first point on the ring at or after the hash of channel, wrapping around
+    auto shard(std::string const &channel) const -> std::size_t
+    {
+        auto const hash = ringHash(channel);
+        auto const point = std::lower_bound(
+                ring_.begin(), ring_.end(), hash,
+                [](auto const &node, std::uint64_t value) { return node.first < value; });
+        return point == ring_.end() ? ring_.front().second : point->second;
+    }
+
+    auto client(std::size_t shard) const -> Client & { return *shards_.at(shard)->client; }
+    auto executor(std::size_t shard) const -> Executor const & { return shards_.at(shard)->strand; }
+
+private:
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::vector<std::pair<std::uint64_t, std::size_t>> ring_;
+};
+
+ShardedClient::ShardedClient(std::string url, ClientConfig config, ShardingConfig sharding)
+    : pImpl {std::make_unique<Impl>(url, config, sharding)}
+{
+}
+
+ShardedClient::~ShardedClient() = default;
+
+auto ShardedClient::shards() const -> std::size_t
+{
+    return pImpl->shards();
+}
+
+auto ShardedClient::shard(std::string const &channel) const -> std::size_t
+{
+    return pImpl->shard(channel);
+}
+
+// Every shard connects with the same credentials, so the server subscribes all of them to the
+// server-side channels. Only the shard a channel is assigned to passes its events on.
+template<typename... Args>
+auto ShardedClient::owned(std::size_t shard,
+                          std::function<void(std::string const &, Args...)> const &callback) const
+        -> std::function<void(std::string const &, Args...)>
+{
+    if (!callback) {
+        return {};
+    }
+    return [this, shard, callback](std::string const &channel, Args... args) {
+        if (this->shard(channel) == shard) {
+            callback(channel, args...);
+        }
+    };
+}
+
+// Hands every shard its share of channels at once and puts the results back in their order
+template<typename Result, typename Many>
+auto ShardedClient::spread(std::vector<std::string> const &channels, Many &&many)
+        -> std::vector<Result>
+{
+    auto positions = std::vector<std::vector<std::size_t>>(shards());
+    for (auto i = std::size_t {0}; i < channels.size(); ++i) {
+        positions[shard(channels[i])].push_back(i);
+    }
+
+    auto results = std::vector<std::optional<Result>>(channels.size());
+    for (auto i = std::size_t {0}; i < shards(); ++i) {
+        if (positions[i].empty()) {
+            continue;
+        }
+        auto share = std::vector<std::string> {};
+        share.reserve(positions[i].size());
+        for (auto const position : positions[i]) {
+            share.push_back(channels[position]);
+        }
+        auto shareResults = executeOn(i, [&](Client &client) { return many(client, share); });
+        for (auto j = std::size_t {0}; j < shareResults.size(); ++j) {
+            results[positions[i][j]].emplace(std::move(shareResults[j]));
+        }
+    }
+
+    auto ordered = std::vector<Result> {};
+    ordered.reserve(results.size());
+    for (auto &result : results) {
+        ordered.push_back(std::move(*result));
+    }
+    return ordered;
+}
+
+auto ShardedClient::state() const -> ConnectionState
+{
+    auto state = ConnectionState::Connected;
+    for (auto i = std::size_t {0}; i < shards(); ++i) {
+        state = std::min(state, executeOn(i, [](Client &client) { return client.state(); }));
+    }
+    return state;
+}
+
+auto ShardedClient::connect() -> outcome::result<void, Error>
+{
+    for (auto i = std::size_t {0}; i < shards(); ++i) {
+        if (auto result = executeOn(i, [](Client &client) { return client.connect(); });
+            !result) {
+            return result;
+        }
+    }
+    return outcome::success();
+}
+
+auto ShardedClient::disconnect() -> void
+{
+    for (auto i = std::size_t {0}; i < shards(); ++i) {
+        executeOn(i, [](Client &client) { client.disconnect(); });
+    }
+}
+
+auto ShardedClient::publish(std::string const &channel, nlohmann::json const &data)
+        -> outcome::result<void, Error>
+{
+    return execute(channel, [&](Client &client) { return client.publish(channel, data); });
+}
+
+auto ShardedClient::publish(std::string const &channel, RawJson const &data)
+        -> outcome::result<void, Error>
+{
+    return execute(channel, [&](Client &client) { return client.publish(channel, data); });
+}
+
+auto ShardedClient::publishMany(std::vector<std::string> const &channels,
+                                nlohmann::json const &data)
+        -> std::vector<outcome::result<void, Error>>
+{
+    return spread<outcome::result<void, Error>>(
+            channels, [&](Client &client, auto const &share) {
+                return client.publishMany(share, data);
+            });
+}
+
+auto ShardedClient::publishMany(std::vector<std::string> const &channels, RawJson const &data)
+        -> std::vector<outcome::result<void, Error>>
+{
+    return spread<outcome::result<void, Error>>(
+            channels, [&](Client &client, auto const &share) {
+                return client.publishMany(share, data);
+            });
+}
+
+auto ShardedClient::send(nlohmann::json const &data) -> outcome::result<void, Error>
+{
+    return executeOn(0, [&](Client &client) { return client.send(data); });
+}
+
+auto ShardedClient::newSubscription(std::string const &channel,
+                                    SubscriptionOptions const &options)
+        -> outcome::result<SubscriptionRef, std::string>
+{
+    return execute(channel,
+                   [&](Client &client) { return client.newSubscription(channel, options); });
+}
+
+auto ShardedClient::subscribeMany(std::vector<std::string> const &channels,
+                                  SubscriptionOptions const &options)
+        -> std::vector<outcome::result<SubscriptionRef, std::string>>
+{
+    return spread<outcome::result<SubscriptionRef, std::string>>(
+            channels, [&](Client &client, auto const &share) {
+                return client.subscribeMany(share, options);
+            });
+}
+
+auto ShardedClient::removeSubscription(SubscriptionRef const &sub) -> void
+{
+    execute(sub.get().channel(), [&](Client &client) { client.removeSubscription(sub); });
+}
+
+auto ShardedClient::removeSubscription(std::string const &channel) -> void
+{
+    execute(channel, [&](Client &client) {
+        if (auto const sub = client.subscription(channel)) {
+            client.removeSubscription(*sub);
+        }
+    });
+}
+
+auto ShardedClient::subscription(std::string const &channel) const
+        -> std::optional<SubscriptionRef>
+{
+    return execute(channel, [&](Client &client) { return client.subscription(channel); });
+}
+
+auto ShardedClient::subscriptions() const -> std::unordered_map<std::string, SubscriptionRef>
+{
+    auto all = std::unordered_map<std::string, SubscriptionRef> {};
+    for (auto i = std::size_t {0}; i < shards(); ++i) {
+        all.merge(executeOn(i, [](Client &client) { return client.subscriptions(); }));
+    }
+    return all;
+}
+
+auto ShardedClient::onConnecting(std::function<void(Error const &)> callback) -> void
+{
+    for (auto i = std::size_t {0}; i < shards(); ++i) {
+        executeOn(i, [&](Client &client) { client.onConnecting(callback); });
+    }
+}
+
+auto ShardedClient::onConnected(std::function<void()> callback) -> void
+{
+    for (auto i = std::size_t {0}; i < shards(); ++i) {
+        executeOn(i, [&](Client &client) { client.onConnected(callback); });
+    }
+}
+
+auto ShardedClient::onDisconnected(std::function<void(Error const &)> callback) -> void
+{
+    for (auto i = std::size_t {0}; i < shards(); ++i) {
+        executeOn(i, [&](Client &client) { client.onDisconnected(callback); });
+    }
+}
+
+auto ShardedClient::onSubscribing(std::function<void(std::string const &channel)> callback)
+        -> void
+{
+    for (auto i = std::size_t {0}; i < shards(); ++i) {
+        executeOn(i, [&](Client &client) { client.onSubscribing(owned(i, callback)); });
+    }
+}
+
+auto ShardedClient::onSubscribed(std::function<void(std::string const &channel)> callback) -> void
+{
+    for (auto i = std::size_t {0}; i < shards(); ++i) {
+        executeOn(i, [&](Client &client) { client.onSubscribed(owned(i, callback)); });
+    }
+}
+
+auto ShardedClient::onUnsubscribed(std::function<void(std::string const &channel)> callback)
+        -> void
+{
+    for (auto i = std::size_t {0}; i < shards(); ++i) {
+        executeOn(i, [&](Client &client) { client.onUnsubscribed(owned(i, callback)); });
+    }
+}
+
+auto ShardedClient::onPublication(
+        std::function<void(std::string const &channel, Publication const &)> callback) -> void
+{
+    for (auto i = std::size_t {0}; i < shards(); ++i) {
+        executeOn(i, [&](Client &client) { client.onPublication(owned(i, callback)); });
+    }
+}
+
+auto ShardedClient::onError(std::function<void(Error const &)> callback) -> void
+{
+    for (auto i = std::size_t {0}; i < shards(); ++i) {
+        executeOn(i, [&](Client &client) { client.onError(callback); });
+    }
+}
+
+auto ShardedClient::onSslContextConfigure(
+        std::function<bool(boost::asio::ssl::context &)> callback) -> void
+{
+    for (auto i = std::size_t {0}; i < shards(); ++i) {
+        executeOn(i, [&](Client &client) { client.onSslContextConfigure(callback); });
+    }
+}
+
+auto ShardedClient::client(std::size_t shard) const -> Client &
+{
+    return pImpl->client(shard);
+}
+
+auto ShardedClient::executor(std::size_t shard) const -> Executor const &
+{
+    return pImpl->executor(shard);
+}
+
+}
@@ -0,0 +1,74 @@
+#include "subscribe_scheduler.h"
+
+#include <algorithm>
+
+namespace centrifugo {
+
+SubscribeScheduler::SubscribeScheduler(
+        boost::asio::strand<boost::asio::io_context::executor_type> const &strand,
+        SubscribePacing const &pacing, SendFunc send)
+    : timer_ {strand}
+    , pacing_ {pacing}
+    , send_ {std::move(send)}
+{
+}
+
+auto SubscribeScheduler::request(std::string const &channel) -> void
+{
+    if (pacing_.batchSize == 0) {
+        send_(channel);
+        return;
+    }
+
+    if (queued_.insert(channel).second) {
+        queue_.push_back(channel);
+        drain();
+    }
+}
+
+auto SubscribeScheduler::cancel(std::string const &channel) -> bool
+{
+    if (queued_.erase(channel) == 0) {
+        return false;
+    }
+    queue_.erase(std::find(queue_.begin(), queue_.end(), channel));
+    return true;
+}
+
+auto SubscribeScheduler::clear() -> void
+{
+    queue_.clear();
+    queued_.clear();
+}
+
+auto SubscribeScheduler::drain() -> void
+{
+    auto const now = Clock::now();
+    if (now >= intervalStart_ + pacing_.interval) {
+        intervalStart_ = now;
+        sentInInterval_ = 0;
+    }
+
+    while (!queue_.empty() && sentInInterval_ < pacing_.batchSize) {
+        auto const channel = std::move(queue_.front());
+        queue_.pop_front();
+        queued_.erase(channel);
+        ++sentInInterval_;
+        send_(channel);
+    }
+
+    if (queue_.empty() || armed_) {
+        return;
+    }
+    armed_ = true;
+    timer_.expires_at(intervalStart_ + pacing_.interval);
+    timer_.async_wait([this](boost::system::error_code ec) {
+        if (ec) {
+            return;
+        }
+        armed_ = false;
+        drain();
+    });
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_set>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+
+#include <centrifugo/common.h>
+
+namespace centrifugo {
+
+// Paces subscribe commands to SubscribePacing::batchSize per interval, in the order they were
+// requested. A batch is sent within one event loop turn, so it goes out in one frame.
+class SubscribeScheduler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    // Sends the subscribe command of channel
+    using SendFunc = std::function<void(std::string const &channel)>;
+
+    SubscribeScheduler(boost::asio::strand<boost::asio::io_context::executor_type> const &strand,
+                       SubscribePacing const &pacing, SendFunc send);
+
+    SubscribeScheduler(SubscribeScheduler const &) = delete;
+    auto operator=(SubscribeScheduler const &) -> SubscribeScheduler & = delete;
+
+    // Sends the subscribe of channel now if the current interval has room, queues it otherwise.
+    // A channel already queued keeps its place.
+    auto request(std::string const &channel) -> void;
+    // Returns false if channel wasn't queued
+    auto cancel(std::string const &channel) -> bool;
+    // Forgets every queued channel, for a connection which is gone
+    auto clear() -> void;
+
+    auto size() const -> std::size_t { return queue_.size(); }
+
+private:
+    auto drain() -> void;
+
+    boost::asio::steady_timer timer_;
+    SubscribePacing pacing_;
+    SendFunc send_;
+
+    std::deque<std::string> queue_;
+    std::unordered_set<std::string> queued_;
+    Clock::time_point intervalStart_;
+    std::size_t sentInInterval_ {0};
+    bool armed_ {false};
+};
+
+}
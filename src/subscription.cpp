@@ -1,5 +1,7 @@
 #include <centrifugo/subscription.h>
 
+#include <boost/asio/strand.hpp>
+
 #include "subscription_impl.h"
 
 namespace centrifugo {
@@ -34,6 +36,11 @@ auto Subscription::publish(nlohmann::json const &json) -> outcome::result<void,
     return impl->publish(json);
 }
 
+auto Subscription::publish(RawJson const &json) -> outcome::result<void, Error>
+{
+    return impl->publish(json);
+}
+
 auto Subscription::onSubscribing(std::function<void()> callback) -> void
 {
     impl->onSubscribing().connect(callback);
@@ -54,9 +61,24 @@ auto Subscription::onPublication(std::function<void(Publication const &)> callba
     impl->onPublication().connect(callback);
 }
 
+auto Subscription::onJoin(std::function<void(ClientInfo const &)> callback) -> void
+{
+    impl->onJoin().connect(callback);
+}
+
+auto Subscription::onLeave(std::function<void(ClientInfo const &)> callback) -> void
+{
+    impl->onLeave().connect(callback);
+}
+
 auto Subscription::onError(std::function<void(Error const &)> callback) -> void
 {
     impl->onError().connect(callback);
 }
 
+auto Subscription::bindExecutor(boost::asio::any_io_executor executor) -> void
+{
+    impl->setExecutor(boost::asio::make_strand(std::move(executor)));
+}
+
 }
@@ -1,14 +1,23 @@
 #include "subscription_impl.h"
 
+#include <boost/asio/post.hpp>
+
 #include <centrifugo/subscription.h>
 #include <centrifugo/error.h>
 #include "protocol_all.h"
+#include "fossil_delta.h"
 
 namespace centrifugo {
 
-SubscriptionImpl::SubscriptionImpl(std::string const &channel, Transport &transport)
+SubscriptionImpl::SubscriptionImpl(std::string const &channel, Transport &transport,
+                                   SubscribeScheduler &scheduler, DeliveryQueue &delivery,
+                                   ReplyRoutes &routes, SubscriptionOptions const &options)
     : channel_ {channel}
     , transport_ {transport}
+    , scheduler_ {scheduler}
+    , delivery_ {delivery}
+    , routes_ {routes}
+    , options_ {options}
     , subscription_ {this}
 {
     init();
@@ -22,18 +31,32 @@ SubscriptionImpl::~SubscriptionImpl()
 SubscriptionImpl::SubscriptionImpl(SubscriptionImpl &&other) noexcept
     : channel_ {std::move(other.channel_)}
     , transport_ {other.transport_}
+    , scheduler_ {other.scheduler_}
+    , delivery_ {other.delivery_}
+    , routes_ {other.routes_}
+    , options_ {other.options_}
     , subscription_ {this}
     , state_ {other.state_}
-    , waitingReplies_ {std::move(other.waitingReplies_)}
     , epoch_ {std::move(other.epoch_)}
     , offset_ {other.offset_}
     , recoverable_ {other.recoverable_}
+    , positioned_ {other.positioned_}
+    , deltaNegotiated_ {other.deltaNegotiated_}
+    , prevData_ {std::move(other.prevData_)}
+    , subscribedInConnect_ {other.subscribedInConnect_}
+    , unsubscribeFirst_ {other.unsubscribeFirst_}
+    , subscribeCommandId_ {other.subscribeCommandId_}
+    , executor_ {std::move(other.executor_)}
     , subscribingSignal_ {std::move(other.subscribingSignal_)}
     , subscribedSignal_ {std::move(other.subscribedSignal_)}
     , unsubscribedSignal_ {std::move(other.unsubscribedSignal_)}
     , publicationSignal_ {std::move(other.publicationSignal_)}
+    , joinSignal_ {std::move(other.joinSignal_)}
+    , leaveSignal_ {std::move(other.leaveSignal_)}
     , errorSignal_ {std::move(other.errorSignal_)}
+    , self_ {std::move(other.self_)}
 {
+    *self_ = this;
     other.deinit();
     init();
 }
@@ -63,7 +86,7 @@ auto SubscriptionImpl::subscribe() -> outcome::result<void, std::string>
     subscribingSignal_();
 
     if (transport_.state() == ConnectionState::Connected) {
-        sendSubscribeCmd();
+        scheduler_.request(channel_);
     }
     return outcome::success();
 }
@@ -76,11 +99,15 @@ auto SubscriptionImpl::unsubscribe() -> void
 
     // Clear recovery state so a subsequent subscribe() starts fresh
     recoverable_ = false;
+    positioned_ = false;
     epoch_.clear();
     offset_ = 0;
+    deltaNegotiated_ = false;
+    prevData_.clear();
 
-    if (transport_.state() == ConnectionState::Connected) {
-        sendCmd(makeCommand(UnsubscribeRequest {channel_}));
+    // Nothing reached the server yet while the subscribe waits in the scheduler
+    if (transport_.state() == ConnectionState::Connected && !scheduler_.cancel(channel_)) {
+        sendCmd(UnsubscribeRequest {channel_});
     } else {
         setState(SubscriptionState::UNSUBSCRIBED);
     }
@@ -91,18 +118,143 @@ auto SubscriptionImpl::publish(nlohmann::json const &json) -> outcome::result<vo
     if (state_ != SubscriptionState::SUBSCRIBED) {
         return Error {ErrorType::NotSubscribed, "not subscribed"};
     }
-    sendCmd(makeCommand(PublishRequest {channel_, json}));
-    return outcome::success();
+    return sendPublish(PublishRequest {channel_, &json, {}});
+}
+
+auto SubscriptionImpl::publish(RawJson const &json) -> outcome::result<void, Error>
+{
+    if (state_ != SubscriptionState::SUBSCRIBED) {
+        return Error {ErrorType::NotSubscribed, "not subscribed"};
+    }
+    if (transport_.config().validateRawJson && !nlohmann::json::accept(json.view())) {
+        return Error {ErrorType::InvalidJson, "publish data is not valid JSON"};
+    }
+    auto req = PublishRequest {};
+    req.channel = channel_;
+    req.raw = json;
+    return sendPublish(std::move(req));
 }
 
 auto SubscriptionImpl::handlePublish(Publication const &publication) -> void
 {
-    // Track stream position for recovery
-    if (publication.offset > 0) {
-        offset_ = publication.offset;
+    // Publications still in flight from before a resubscribe are recovered again, deltas
+    // among them have nothing to apply to
+    if ((options_.delta || positioned_) && state_ != SubscriptionState::SUBSCRIBED) {
+        return;
+    }
+
+    if (positioned_ && publication.offset > 0) {
+        if (publication.offset <= offset_) {
+            return; // delivered already, e.g. recovered and received live
+        }
+        if (publication.offset != offset_ + 1) {
+            // Only this channel subscribes again, recoverable ones get the gap filled in
+            if (!recoverable_) {
+                errorSignal_(Error {ErrorType::PublicationsLost,
+                                    "missed publications in channel " + channel_});
+            }
+            resubscribe();
+            return;
+        }
+    }
+
+    if (!deltaNegotiated_) {
+        // Track stream position for recovery
+        if (publication.offset > 0) {
+            offset_ = publication.offset;
+        }
+        deliver(publication);
+        return;
+    }
+
+    auto restored = publication;
+    if (!restorePayload(restored)) {
+        // Later deltas can't apply either, start over from the last publication delivered
+        errorSignal_(Error {ErrorType::InvalidDelta,
+                            "cannot apply delta to publication in channel " + channel_});
+        resubscribe();
+        return;
+    }
+
+    if (restored.offset > 0) {
+        offset_ = restored.offset;
+    }
+    deliver(restored);
+}
+
+auto SubscriptionImpl::setExecutor(boost::asio::any_io_executor executor) -> void
+{
+    executor_ = std::move(executor);
+}
+
+auto SubscriptionImpl::deliver(Publication const &publication) -> void
+{
+    auto const parse = !transport_.config().lazyPublicationData;
+    if (!executor_) {
+        if (parse) {
+            publication.payload();
+        }
+        (*publicationSignal_)(publication);
+        return;
+    }
+
+    if (publicationSignal_->empty()) {
+        return;
+    }
+    boost::asio::post(executor_, [signal = std::weak_ptr {publicationSignal_}, publication, parse] {
+        auto const target = signal.lock();
+        if (!target) {
+            return;
+        }
+        if (parse) {
+            publication.payload();
+        }
+        (*target)(publication);
+    });
+}
+
+auto SubscriptionImpl::handleJoin(Join const &join) -> void
+{
+    joinSignal_(join.info);
+}
+
+auto SubscriptionImpl::handleLeave(Leave const &leave) -> void
+{
+    leaveSignal_(leave.info);
+}
+
+auto SubscriptionImpl::restorePayload(Publication &publication) -> bool
+{
+    // JSON carries payloads of delta subscriptions as JSON strings, protobuf as plain bytes
+    auto bytes = std::string {};
+    if (transport_.config().protocol == Protocol::Json) {
+        auto const value = publication.rawData.empty() ? std::move(publication.data)
+                                                       : parsePayload(publication.rawData);
+        if (!value.is_string()) {
+            return false;
+        }
+        bytes = value.get<std::string>();
+    } else {
+        bytes = std::move(publication.rawData);
+    }
+
+    if (publication.delta) {
+        auto target = fossil::applyDelta(prevData_, bytes);
+        if (!target) {
+            return false;
+        }
+        bytes = std::move(*target);
     }
+    prevData_ = bytes;
 
-    publicationSignal_(publication);
+    publication.data = nullptr;
+    publication.rawData.clear();
+    if (transport_.lazyDecode()) {
+        publication.rawData = std::move(bytes);
+    } else {
+        publication.data = parsePayload(bytes);
+    }
+    return true;
 }
 
 auto SubscriptionImpl::onSubscribing() -> SubscribingSignal &
@@ -122,7 +274,17 @@ auto SubscriptionImpl::onUnsubscribed() -> UnsubscribedSignal &
 
 auto SubscriptionImpl::onPublication() -> PublicationSignal &
 {
-    return publicationSignal_;
+    return *publicationSignal_;
+}
+
+auto SubscriptionImpl::onJoin() -> JoinSignal &
+{
+    return joinSignal_;
+}
+
+auto SubscriptionImpl::onLeave() -> LeaveSignal &
+{
+    return leaveSignal_;
 }
 
 auto SubscriptionImpl::onError() -> ErrorSignal &
@@ -132,32 +294,91 @@ auto SubscriptionImpl::onError() -> ErrorSignal &
 
 auto SubscriptionImpl::init() -> void
 {
+    if (options_.delta && !retainsRawPayloads_) {
+        transport_.retainRawPayloads();
+        retainsRawPayloads_ = true;
+    }
+
     onConnectingConnection_ = transport_.onConnecting().connect([this](auto const &) {
+        subscribedInConnect_ = false;
+        unsubscribeFirst_ = false;
+        subscribeCommandId_ = 0;
         if (state_ == SubscriptionState::SUBSCRIBED) {
             setState(SubscriptionState::SUBSCRIBING);
         }
     });
 
-    onConnectedConnection_ = transport_.onConnected().connect([this](auto const &) {
-        if (state_ == SubscriptionState::SUBSCRIBING) {
-            sendSubscribeCmd();
+    onConnectRequestConnection_ =
+            transport_.onConnectRequest().connect([this](ConnectRequest &req) {
+                if (transport_.config().subscribeInConnect
+                    && state_ == SubscriptionState::SUBSCRIBING) {
+                    req.subs.emplace(channel_, subscribeRequest());
+                    subscribedInConnect_ = true;
+                }
+            });
+
+    onConnectedConnection_ = transport_.onConnected().connect([this](ConnectResult const &result) {
+        if (state_ != SubscriptionState::SUBSCRIBING) {
+            return;
+        }
+        if (std::exchange(subscribedInConnect_, false)) {
+            if (auto const sub = result.subs.find(channel_); sub != result.subs.end()) {
+                handleSubscribed(sub->second);
+                return;
+            }
         }
+        scheduler_.request(channel_);
     });
 }
 
 auto SubscriptionImpl::deinit() -> void
 {
+    if (retainsRawPayloads_) {
+        transport_.releaseRawPayloads();
+        retainsRawPayloads_ = false;
+    }
+
     onConnectingConnection_.disconnect();
     onConnectedConnection_.disconnect();
+    onConnectRequestConnection_.disconnect();
 }
 
-auto SubscriptionImpl::sendCmd(Command &&cmd) -> void
+auto SubscriptionImpl::sendCmd(Command::RequestType &&req) -> std::uint32_t
 {
-    waitingReplies_.emplace(cmd.id);
-    transport_.send(std::move(cmd));
+    auto const id = transport_.send(std::move(req));
+    routes_.add(id, self_);
+    return id;
 }
 
-auto SubscriptionImpl::sendSubscribeCmd() -> void
+auto SubscriptionImpl::sendPublish(PublishRequest &&req) -> outcome::result<void, Error>
+{
+    // A publish held back by OverflowPolicy::Wait gets its id later, or fails
+    auto handler = Transport::PublishHandler {};
+    if (transport_.config().outbound.overflow == OverflowPolicy::Wait) {
+        handler = [self = std::weak_ptr {self_}](outcome::result<std::uint32_t, Error> id) {
+            auto const impl = self.lock();
+            if (!impl) {
+                return;
+            }
+            if (id) {
+                (*impl)->routes_.add(id.assume_value(), impl);
+            } else {
+                (*impl)->errorSignal_(id.assume_error());
+            }
+        };
+    }
+
+    auto const id = transport_.publish(std::move(req), std::move(handler));
+    if (!id) {
+        return id.assume_error();
+    }
+    if (id.assume_value() != 0) {
+        routes_.add(id.assume_value(), self_);
+    }
+    return outcome::success();
+}
+
+auto SubscriptionImpl::subscribeRequest() const -> SubscribeRequest
 {
     auto req = SubscribeRequest {};
     req.channel = channel_;
@@ -168,42 +389,104 @@ auto SubscriptionImpl::sendSubscribeCmd() -> void
         req.epoch = epoch_;
         req.offset = offset_;
     }
+    if (options_.delta) {
+        req.delta = "fossil";
+    }
+    req.recoverable = options_.recoverable;
+    req.positioned = options_.positioned;
+    req.join_leave = options_.joinLeave;
+    return req;
+}
+
+auto SubscriptionImpl::sendSubscribeCmd() -> void
+{
+    // The unsubscribe reply isn't waited for, the server handles commands in order
+    if (std::exchange(unsubscribeFirst_, false)) {
+        transport_.send(UnsubscribeRequest {channel_});
+    }
+    subscribeCommandId_ = sendCmd(subscribeRequest());
+}
 
-    sendCmd(makeCommand(std::move(req)));
+auto SubscriptionImpl::resubscribe() -> void
+{
+    setState(SubscriptionState::SUBSCRIBING);
+    deltaNegotiated_ = false;
+    prevData_.clear();
+
+    // Takes its turn like any other subscribe, the server still has the channel subscribed
+    unsubscribeFirst_ = true;
+    scheduler_.request(channel_);
 }
 
-auto SubscriptionImpl::handleReply(Reply const &reply) -> bool
+auto SubscriptionImpl::sendScheduledSubscribe() -> void
 {
-    if (waitingReplies_.erase(reply.id) == 0) {
-        return false;
+    if (state_ == SubscriptionState::SUBSCRIBING
+        && transport_.state() == ConnectionState::Connected) {
+        sendSubscribeCmd();
     }
+}
+
+auto SubscriptionImpl::handleReply(Reply const &reply) -> void
+{
     std::visit(
-            [this](auto const &result) {
+            [this, &reply](auto const &result) {
                 using ResultType = std::decay_t<decltype(result)>;
 
                 if constexpr (std::is_same_v<ResultType, ErrorReply>) {
                     errorSignal_(Error {static_cast<ErrorType>(result.code), result.message});
-                } else if constexpr (std::is_same_v<ResultType, SubscribeResult>) {
-                    // Store stream position for recovery on reconnect
-                    recoverable_ = result.recoverable;
-                    epoch_ = result.epoch;
-                    // When there are recovered publications, let handlePublish()
-                    // advance offset_ from each one. Otherwise use result.offset
-                    // as the baseline stream position.
-                    if (result.publications.empty()) {
-                        offset_ = result.offset;
-                    }
-
-                    setState(SubscriptionState::SUBSCRIBED);
-                    for (auto const &publication : result.publications) {
-                        handlePublish(publication);
+                    // A subscribe without reply is sent again, the timeout spaced the attempts.
+                    // The server may have subscribed all the same: the late reply still comes
+                    // through the route of the command and the retry unsubscribes first, so it
+                    // can't fail with AlreadySubscribed. Publishes time out as well, they don't
+                    // retry the subscribe.
+                    if (static_cast<ErrorType>(result.code) == ErrorType::Timeout
+                        && reply.id == subscribeCommandId_
+                        && state_ == SubscriptionState::SUBSCRIBING) {
+                        unsubscribeFirst_ = true;
+                        scheduler_.request(channel_);
                     }
+                } else if constexpr (std::is_same_v<ResultType, SubscribeResult>) {
+                    handleSubscribed(result);
                 } else if constexpr (std::is_same_v<ResultType, UnsubscribeResult>) {
                     setState(SubscriptionState::UNSUBSCRIBED);
                 }
             },
             reply.result);
-    return true;
+}
+
+auto SubscriptionImpl::handleSubscribed(SubscribeResult const &result) -> void
+{
+    // A retry still waiting for its turn isn't needed anymore
+    if (scheduler_.cancel(channel_)) {
+        unsubscribeFirst_ = false;
+    }
+
+    // Store stream position for recovery on reconnect
+    recoverable_ = result.recoverable;
+    positioned_ = result.recoverable || result.positioned;
+    epoch_ = result.epoch;
+    // The first publication after subscribing carries the full payload
+    deltaNegotiated_ = result.delta;
+    prevData_.clear();
+    // When there are recovered publications, let handlePublish()
+    // advance offset_ from each one. Otherwise use result.offset
+    // as the baseline stream position.
+    if (result.was_recovering && !result.recovered) {
+        errorSignal_(Error {ErrorType::PublicationsLost,
+                            "cannot recover publications in channel " + channel_});
+        // What did come back starts the stream over
+        if (!result.publications.empty() && result.publications.front().offset > 0) {
+            offset_ = result.publications.front().offset - 1;
+        }
+    }
+    if (result.publications.empty()) {
+        offset_ = result.offset;
+    }
+
+    setState(SubscriptionState::SUBSCRIBED);
+    // Recovered publications of an earlier subscribe still waiting are superseded
+    delivery_.cancel(channel_);
+    delivery_.deliver(channel_, result.publications);
 }
 
 auto SubscriptionImpl::setState(SubscriptionState newState) -> void
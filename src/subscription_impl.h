@@ -1,11 +1,16 @@
 #pragma once
 
-#include <unordered_set>
+#include <memory>
+
+#include <boost/asio/any_io_executor.hpp>
 
 #include <boost/signals2/signal.hpp>
 
 #include <centrifugo/subscription.h>
 #include "transport.h"
+#include "subscribe_scheduler.h"
+#include "delivery_queue.h"
+#include "reply_routes.h"
 
 namespace centrifugo {
 
@@ -16,9 +21,13 @@ public:
     using SubscribedSignal = boost::signals2::signal<void()>;
     using UnsubscribedSignal = boost::signals2::signal<void()>;
     using PublicationSignal = boost::signals2::signal<void(Publication const &)>;
+    using JoinSignal = boost::signals2::signal<void(ClientInfo const &)>;
+    using LeaveSignal = boost::signals2::signal<void(ClientInfo const &)>;
     using ErrorSignal = boost::signals2::signal<void(Error const &)>;
 
-    SubscriptionImpl(std::string const &channel, Transport &transport);
+    SubscriptionImpl(std::string const &channel, Transport &transport,
+                     SubscribeScheduler &scheduler, DeliveryQueue &delivery,
+                     ReplyRoutes &routes, SubscriptionOptions const &options = {});
     ~SubscriptionImpl();
 
     SubscriptionImpl(SubscriptionImpl const &) = delete;
@@ -35,45 +44,87 @@ public:
     auto subscribe() -> outcome::result<void, std::string>;
     auto unsubscribe() -> void;
     auto publish(nlohmann::json const &json) -> outcome::result<void, Error>;
+    auto publish(RawJson const &json) -> outcome::result<void, Error>;
 
-    auto handleReply(Reply const &reply) -> bool;
+    // Called by the SubscribeScheduler when the turn of this subscription comes
+    auto sendScheduledSubscribe() -> void;
+    // Replies come through the ReplyRoutes of the commands this subscription sent
+    auto handleReply(Reply const &reply) -> void;
     auto handlePublish(Publication const &publication) -> void;
+    // Publications are delivered on executor from then on, it is expected to keep them in order
+    auto setExecutor(boost::asio::any_io_executor executor) -> void;
+    auto handleJoin(Join const &join) -> void;
+    auto handleLeave(Leave const &leave) -> void;
 
     auto onSubscribing() -> SubscribingSignal &;
     auto onSubscribed() -> SubscribedSignal &;
     auto onUnsubscribed() -> UnsubscribedSignal &;
     auto onPublication() -> PublicationSignal &;
+    auto onJoin() -> JoinSignal &;
+    auto onLeave() -> LeaveSignal &;
     auto onError() -> ErrorSignal &;
 
 private:
     auto init() -> void;
     auto deinit() -> void;
-    auto sendCmd(Command &&cmd) -> void;
+    auto sendCmd(Command::RequestType &&req) -> std::uint32_t;
+    auto sendPublish(PublishRequest &&req) -> outcome::result<void, Error>;
+    auto subscribeRequest() const -> SubscribeRequest;
     auto sendSubscribeCmd() -> void;
+    auto handleSubscribed(SubscribeResult const &result) -> void;
+    auto restorePayload(Publication &publication) -> bool;
+    auto deliver(Publication const &publication) -> void;
+    auto resubscribe() -> void;
     auto setState(SubscriptionState newState) -> void;
 
 private:
     std::string channel_;
     Transport &transport_;
+    SubscribeScheduler &scheduler_;
+    DeliveryQueue &delivery_;
+    ReplyRoutes &routes_;
+    SubscriptionOptions options_;
 
     Subscription subscription_;
     SubscriptionState state_ = SubscriptionState::UNSUBSCRIBED;
-    std::unordered_set<std::uint32_t> waitingReplies_;
 
     // Stream recovery state
     std::string epoch_;
     std::uint64_t offset_ {0};
     bool recoverable_ {false};
+    // Offsets of the stream go up one by one and are checked
+    bool positioned_ {false};
+
+    // Fossil delta state, deltas apply to the payload of the previous publication
+    bool deltaNegotiated_ {false};
+    std::string prevData_;
+    bool retainsRawPayloads_ {false};
+    // The subscribe went out within the connect command
+    bool subscribedInConnect_ {false};
+    // A subscribe of this connection timed out and may have gone through, the next one
+    // unsubscribes first
+    bool unsubscribeFirst_ {false};
+    // Id of the last subscribe sent on its own, 0 if there is none on this connection
+    std::uint32_t subscribeCommandId_ {0};
+    // Where onPublication runs, the strand of the transport when empty
+    boost::asio::any_io_executor executor_;
 
     SubscribingSignal subscribingSignal_;
     SubscribedSignal subscribedSignal_;
     UnsubscribedSignal unsubscribedSignal_;
-    PublicationSignal publicationSignal_;
+    // Deliveries posted to executor_ hold it weakly, they are dropped once the subscription is gone
+    std::shared_ptr<PublicationSignal> publicationSignal_ {std::make_shared<PublicationSignal>()};
+    JoinSignal joinSignal_;
+    LeaveSignal leaveSignal_;
     ErrorSignal errorSignal_;
 
     boost::signals2::connection onConnectingConnection_;
     boost::signals2::connection onConnectedConnection_;
+    boost::signals2::connection onConnectRequestConnection_;
     boost::signals2::connection onReplyReceivedConnection_;
+
+    // Follows the subscription as it moves, callbacks which may outlive it hold it weakly
+    std::shared_ptr<SubscriptionImpl *> self_ {std::make_shared<SubscriptionImpl *>(this)};
 };
 
 }
@@ -0,0 +1,213 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace centrifugo {
+
+namespace {
+
+constexpr auto NO_TICK = std::numeric_limits<std::uint64_t>::max();
+
+auto makeId(std::uint32_t index, std::uint32_t generation) -> TimerWheel::TimerId
+{
+    return (static_cast<TimerWheel::TimerId>(generation) << 32) | index;
+}
+
+}
+
+TimerWheel::TimerWheel(boost::asio::strand<boost::asio::io_context::executor_type> const &strand,
+                       Clock::duration tick)
+    : timer_ {strand}
+    , tick_ {tick}
+    , start_ {Clock::now()}
+{
+    heads_.fill(NONE);
+    tails_.fill(NONE);
+}
+
+auto TimerWheel::schedule(Clock::duration delay, Callback callback) -> TimerId
+{
+    auto index = std::uint32_t {};
+    if (free_.empty()) {
+        index = static_cast<std::uint32_t>(nodes_.size());
+        nodes_.emplace_back();
+    } else {
+        index = free_.back();
+        free_.pop_back();
+    }
+
+    // Rounded up, a timer never fires before its delay has passed. The wheel lags behind the
+    // clock until its steady_timer handler runs, so expiry counts from the real time;
+    // advancing here instead would run callbacks from inside schedule().
+    auto const due = std::max(Clock::now() - start_ + delay, Clock::duration::zero());
+    auto const span = std::uint64_t {1} << (SLOT_BITS * LEVELS);
+    auto const expiry = static_cast<std::uint64_t>((due + tick_ - Clock::duration {1}) / tick_);
+
+    auto &node = nodes_[index];
+    node.expiry = std::clamp(expiry, current_ + 1, current_ + span - 1);
+    node.active = true;
+    node.callback = std::move(callback);
+    ++active_;
+
+    link(index, slotOf(node.expiry));
+    arm();
+    return makeId(index, node.generation);
+}
+
+auto TimerWheel::cancel(TimerId id) -> bool
+{
+    auto const index = static_cast<std::uint32_t>(id);
+    auto const generation = static_cast<std::uint32_t>(id >> 32);
+    if (id == NO_TIMER || index >= nodes_.size()) {
+        return false;
+    }
+
+    auto &node = nodes_[index];
+    if (!node.active || node.generation != generation) {
+        return false;
+    }
+
+    unlink(index);
+    node.active = false;
+    node.callback = nullptr;
+    ++node.generation;
+    free_.push_back(index);
+    --active_;
+    return true;
+}
+
+auto TimerWheel::now() const -> std::uint64_t
+{
+    return static_cast<std::uint64_t>((Clock::now() - start_) / tick_);
+}
+
+auto TimerWheel::slotOf(std::uint64_t expiry) const -> std::uint32_t
+{
+    // A timer goes to the level of the highest slot digit where its expiry differs from the
+    // current tick, it moves a level down each time the wheel reaches that digit
+    auto const diff = expiry ^ current_;
+    auto level = 0u;
+    while (level + 1 < LEVELS && (diff >> (SLOT_BITS * (level + 1))) != 0) {
+        ++level;
+    }
+    auto const slot = static_cast<std::uint32_t>((expiry >> (SLOT_BITS * level)) & (SLOTS - 1));
+    return level * SLOTS + slot;
+}
+
+auto TimerWheel::link(std::uint32_t index, std::uint32_t slot) -> void
+{
+    auto &node = nodes_[index];
+    node.slot = slot;
+    node.prev = tails_[slot];
+    node.next = NONE;
+    if (tails_[slot] == NONE) {
+        heads_[slot] = index;
+    } else {
+        nodes_[tails_[slot]].next = index;
+    }
+    tails_[slot] = index;
+}
+
+auto TimerWheel::unlink(std::uint32_t index) -> void
+{
+    auto &node = nodes_[index];
+    (node.prev == NONE ? heads_[node.slot] : nodes_[node.prev].next) = node.next;
+    (node.next == NONE ? tails_[node.slot] : nodes_[node.next].prev) = node.prev;
+    node.slot = NONE;
+    node.prev = NONE;
+    node.next = NONE;
+}
+
+auto TimerWheel::advance(std::uint64_t tick) -> void
+{
+    while (current_ < tick) {
+        ++current_;
+
+        // Higher levels first, their timers may land in a lower slot due at this tick
+        for (auto level = LEVELS - 1; level > 0; --level) {
+            if ((current_ & ((std::uint64_t {1} << (SLOT_BITS * level)) - 1)) == 0) {
+                cascade(level);
+            }
+        }
+        fire(static_cast<std::uint32_t>(current_ & (SLOTS - 1)));
+    }
+}
+
+auto TimerWheel::cascade(unsigned level) -> void
+{
+    // Detached first, a timer of the next turn goes back to the very slot of the top level
+    auto const slot = level * SLOTS
+                    + static_cast<std::uint32_t>((current_ >> (SLOT_BITS * level)) & (SLOTS - 1));
+    auto index = heads_[slot];
+    heads_[slot] = NONE;
+    tails_[slot] = NONE;
+    while (index != NONE) {
+        auto const next = nodes_[index].next;
+        link(index, slotOf(nodes_[index].expiry));
+        index = next;
+    }
+}
+
+auto TimerWheel::fire(std::uint32_t slot) -> void
+{
+    if (heads_[slot] == NONE) {
+        return;
+    }
+
+    // Callbacks may schedule new timers into this very slot, they must wait a full turn. The
+    // due ones move to a slot of their own, where callbacks may still cancel them.
+    heads_[DUE] = std::exchange(heads_[slot], NONE);
+    tails_[DUE] = std::exchange(tails_[slot], NONE);
+    for (auto index = heads_[DUE]; index != NONE; index = nodes_[index].next) {
+        nodes_[index].slot = DUE;
+    }
+
+    while (heads_[DUE] != NONE) {
+        auto const index = heads_[DUE];
+        auto callback = std::move(nodes_[index].callback);
+        cancel(makeId(index, nodes_[index].generation));
+        callback();
+    }
+}
+
+auto TimerWheel::nextTick() const -> std::uint64_t
+{
+    // Slots of a level only hold timers due after the current position of that level, the
+    // first non-empty one of the lowest level is the next thing to do. The top level wraps
+    // around, it also holds timers of the next turn.
+    for (auto level = 0u; level < LEVELS; ++level) {
+        auto const shift = SLOT_BITS * level;
+        auto const position = (current_ >> shift) & (SLOTS - 1);
+        auto const ahead = level + 1 == LEVELS ? SLOTS : SLOTS - 1 - position;
+        for (auto i = std::uint64_t {1}; i <= ahead; ++i) {
+            if (heads_[level * SLOTS + ((position + i) & (SLOTS - 1))] != NONE) {
+                return ((current_ >> shift) + i) << shift;
+            }
+        }
+    }
+    return NO_TICK;
+}
+
+auto TimerWheel::arm() -> void
+{
+    auto const tick = active_ == 0 ? NO_TICK : nextTick();
+    if (tick == NO_TICK || (armed_ != 0 && armed_ <= tick)) {
+        return;
+    }
+
+    armed_ = tick;
+    timer_.expires_at(start_ + tick_ * tick);
+    timer_.async_wait([this, tick](boost::system::error_code ec) {
+        if (ec || armed_ != tick) {
+            return; // re-armed for an earlier tick
+        }
+
+        armed_ = 0;
+        advance(std::max(tick, now()));
+        arm();
+    });
+}
+
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+
+namespace centrifugo {
+
+// Hierarchical timing wheel: any number of timers share one steady_timer on the strand.
+// Scheduling and cancelling are O(1). Timers fire on tick boundaries, so up to one tick late,
+// and delays are capped at the span of the wheel (about 124 days with 10 ms ticks).
+// Timers of a slot are linked through their nodes, so scheduling one doesn't allocate once as
+// many timers as are ever pending at once have been.
+class TimerWheel
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    using TimerId = std::uint64_t;
+    using Callback = std::function<void()>;
+
+    // Never returned by schedule(), cancel() ignores it
+    static constexpr auto NO_TIMER = TimerId {0};
+
+    TimerWheel(boost::asio::strand<boost::asio::io_context::executor_type> const &strand,
+               Clock::duration tick = std::chrono::milliseconds {10});
+
+    TimerWheel(TimerWheel const &) = delete;
+    auto operator=(TimerWheel const &) -> TimerWheel & = delete;
+
+    auto schedule(Clock::duration delay, Callback callback) -> TimerId;
+    // Returns false if the timer already fired or was cancelled
+    auto cancel(TimerId id) -> bool;
+    auto size() const -> std::size_t { return active_; }
+
+private:
+    static constexpr auto SLOT_BITS = 6u;
+    static constexpr auto SLOTS = 1u << SLOT_BITS;
+    static constexpr auto LEVELS = 5u;
+    // Slot of the timers fire() is running, after the ones of the levels
+    static constexpr auto DUE = LEVELS * SLOTS;
+    static constexpr auto NONE = std::numeric_limits<std::uint32_t>::max();
+
+    struct Node {
+        std::uint64_t expiry {0};
+        std::uint32_t generation {1};
+        bool active {false};
+        // Slot the node is linked into, its neighbours there in the order they were linked
+        std::uint32_t slot {NONE};
+        std::uint32_t prev {NONE};
+        std::uint32_t next {NONE};
+        Callback callback;
+    };
+
+    auto now() const -> std::uint64_t;
+    auto slotOf(std::uint64_t expiry) const -> std::uint32_t;
+    auto link(std::uint32_t index, std::uint32_t slot) -> void;
+    auto unlink(std::uint32_t index) -> void;
+    auto advance(std::uint64_t tick) -> void;
+    auto cascade(unsigned level) -> void;
+    auto fire(std::uint32_t slot) -> void;
+    auto nextTick() const -> std::uint64_t;
+    auto arm() -> void;
+
+    boost::asio::steady_timer timer_;
+    Clock::duration tick_;
+    Clock::time_point start_;
+    std::uint64_t current_ {0};
+    // Tick the steady_timer is waiting for, 0 when it isn't armed
+    std::uint64_t armed_ {0};
+
+    // First and last node of every slot, level by level
+    std::array<std::uint32_t, DUE + 1> heads_;
+    std::array<std::uint32_t, DUE + 1> tails_;
+    std::vector<Node> nodes_;
+    std::vector<std::uint32_t> free_;
+    std::size_t active_ {0};
+};
+
+}
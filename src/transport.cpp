@@ -1,8 +1,11 @@
 #include "transport.h"
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <string>
 #include <system_error>
+#include <utility>
 
 #include <boost/url.hpp>
 #include <openssl/ssl.h>
@@ -11,6 +14,7 @@
 #include <centrifugo/common.h>
 #include <centrifugo/error.h>
 #include "protocol_all.h"
+#include "protocol_protobuf.h"
 
 namespace centrifugo {
 
@@ -47,17 +51,111 @@ auto toError(std::error_code ec) -> Error
     return Error {ec, ec.message()};
 }
 
+// Server pings are empty JSON objects, detected on the raw bytes without parsing
+auto isPing(std::string_view message) -> bool
+{
+    auto const first = message.find_first_not_of(" \t\r");
+    if (first == std::string_view::npos) {
+        return false;
+    }
+    auto const last = message.find_last_not_of(" \t\r");
+    return message.substr(first, last - first + 1) == "{}";
+}
+
+auto commandTimeout(CommandTimeouts const &timeouts, Command::RequestType const &request)
+        -> std::chrono::milliseconds
+{
+    return std::visit(
+            [&timeouts](auto const &req) {
+                using RequestType = std::decay_t<decltype(req)>;
+
+                if constexpr (std::is_same_v<RequestType, ConnectRequest>) {
+                    return timeouts.connect;
+                } else if constexpr (std::is_same_v<RequestType, SubscribeRequest>) {
+                    return timeouts.subscribe;
+                } else if constexpr (std::is_same_v<RequestType, UnsubscribeRequest>) {
+                    return timeouts.unsubscribe;
+                } else if constexpr (std::is_same_v<RequestType, PublishRequest>) {
+                    return timeouts.publish;
+                } else if constexpr (std::is_same_v<RequestType, RefreshRequest>) {
+                    return timeouts.refresh;
+                } else {
+                    return std::chrono::milliseconds {0};
+                }
+            },
+            request);
+}
+
+// Control commands keep the connection and subscriptions alive, they jump ahead of data ones
+auto isControl(Command::RequestType const &request) -> bool
+{
+    return !std::holds_alternative<PublishRequest>(request)
+        && !std::holds_alternative<SendRequest>(request);
+}
+
+// Errors a connect gets for the subscriptions it carries, from a server which doesn't take
+// them there or doesn't take these ones
+auto rejectsSubs(ErrorType type) -> bool
+{
+    return type == ErrorType::BadCommand || type == ErrorType::UnknownChannel
+        || type == ErrorType::PermissionDenied;
+}
+
+template<typename Iterator>
+auto recordDelays(QueueDelay &delay, Iterator first, Iterator last,
+                  InFlightCommands::Clock::time_point now) -> void
+{
+    for (; first != last; ++first) {
+        auto const waited = chrono::duration_cast<chrono::nanoseconds>(now - first->queuedAt);
+        ++delay.messages;
+        delay.total += waited;
+        delay.max = std::max(delay.max, waited);
+    }
+}
+
+// permessage_deflate::msg_size_threshold only exists since Boost 1.81
+template<typename Option, typename = void>
+struct HasSizeThreshold : std::false_type {
+};
+
+template<typename Option>
+struct HasSizeThreshold<Option, std::void_t<decltype(std::declval<Option &>().msg_size_threshold)>>
+    : std::true_type {
+};
+
+template<typename Option>
+auto setSizeThreshold(Option &option, std::size_t threshold) -> void
+{
+    if constexpr (HasSizeThreshold<Option>::value) {
+        option.msg_size_threshold = threshold;
+    }
+}
+
+auto toPermessageDeflate(DeflateConfig const &config) -> websocket::permessage_deflate
+{
+    auto option = websocket::permessage_deflate {};
+    option.client_enable = true;
+    option.server_max_window_bits = config.serverMaxWindowBits;
+    option.client_max_window_bits = config.clientMaxWindowBits;
+    option.server_no_context_takeover = config.serverNoContextTakeover;
+    option.client_no_context_takeover = config.clientNoContextTakeover;
+    option.compLevel = config.compressionLevel;
+    option.memLevel = config.memoryLevel;
+    setSizeThreshold(option, config.messageSizeThreshold);
+    return option;
+}
+
 Transport::Transport(net::strand<net::io_context::executor_type> const &strand, std::string &&url,
                      ClientConfig &&config)
     : config_ {std::move(config)}
     , url_ {std::move(url)}
+    , strand_ {strand}
     , resolver_ {strand}
     , ws_ {WsStream {strand}}
-    , reconnectTimer_ {strand}
-    , pingTimer_ {strand}
-    , tokenRefreshTimer_ {strand}
+    , timers_ {strand}
     , rng_ {std::random_device {}()}
     , token_ {config.token}
+    , lingerTimer_ {strand}
 {
     connectingSignal_.connect([this](auto const &) { reconnectAttempts_ = 0; });
 
@@ -75,9 +173,9 @@ Transport::Transport(net::strand<net::io_context::executor_type> const &strand,
     });
 
     disconnectedSignal_.connect([this](auto const &) {
-        reconnectTimer_.cancel();
-        pingTimer_.cancel();
-        tokenRefreshTimer_.cancel();
+        timers_.cancel(reconnectTimer_);
+        timers_.cancel(pingTimer_);
+        timers_.cancel(tokenRefreshTimer_);
         closeConnection();
     });
 }
@@ -87,11 +185,6 @@ auto Transport::state() const -> ConnectionState
     return state_;
 }
 
-auto Transport::sentCommands() const -> std::unordered_map<std::uint32_t, Command> const &
-{
-    return sentCommands_;
-}
-
 auto Transport::initialConnect() -> outcome::result<void, Error>
 {
     if (state_ != ConnectionState::Disconnected) {
@@ -113,10 +206,25 @@ auto Transport::initialConnect() -> outcome::result<void, Error>
         return Error {std::make_error_code(std::errc::invalid_argument),
                       "Version cannot be longer than 16 characters"};
     }
+    // Beast throws from set_option() on these, which would happen on every reconnect
+    if (auto const &deflate = config_.deflate; deflate.enabled) {
+        auto const inRange = [](int value, int min, int max) {
+            return value >= min && value <= max;
+        };
+        if (!inRange(deflate.serverMaxWindowBits, 9, 15)
+            || !inRange(deflate.clientMaxWindowBits, 9, 15)) {
+            return Error {std::make_error_code(std::errc::invalid_argument),
+                          "deflate window bits must be within 9..15"};
+        }
+        if (!inRange(deflate.compressionLevel, 0, 9) || !inRange(deflate.memoryLevel, 1, 9)) {
+            return Error {std::make_error_code(std::errc::invalid_argument),
+                          "deflate compression level must be within 0..9, memory level 1..9"};
+        }
+    }
 
     auto parseResult = parseUrl(url_);
     if (!parseResult) {
-        return parseResult.error();
+        return parseResult.assume_error();
     }
 
     urlComponents_ = parseResult.assume_value();
@@ -142,28 +250,354 @@ auto Transport::initialConnect() -> outcome::result<void, Error>
 
 auto Transport::disconnect(Error const &error) -> void
 {
+    // Messages left of the frame being handled belong to the connection going away
+    ++readSerial_;
     setState(ConnectionState::Disconnected, error);
 }
 
-auto Transport::send(json const &j, Command &&cmd) -> void
+auto Transport::send(Command::RequestType &&req) -> std::uint32_t
+{
+    auto cmd = Command {};
+    cmd.id = ++lastCommandId_;
+    cmd.request = std::move(req);
+
+    // Commands are encoded straight into the pending frame of their lane, a payload which fails
+    // to serialize must not leave half a command behind
+    auto const control = isControl(cmd.request);
+    auto &out = control ? controlWrites_ : pendingWrites_;
+    auto const size = out.size();
+    try {
+        if (config_.protocol == Protocol::Protobuf) {
+            protobuf::encode(cmd, out);
+        } else {
+            beginJson(out);
+            encodeJson(cmd, out);
+        }
+    } catch (...) {
+        out.resize(size);
+        throw;
+    }
+    // Send commands are one way, the server doesn't reply to them
+    if (!std::holds_alternative<SendRequest>(cmd.request)) {
+        auto entry = InFlightCommands::Entry {};
+        entry.id = cmd.id;
+        entry.requestType = static_cast<std::uint8_t>(cmd.request.index());
+        entry.queuedAt = InFlightCommands::Clock::now();
+        if (auto const timeout = commandTimeout(config_.commandTimeouts, cmd.request);
+            timeout.count() > 0) {
+            entry.deadline = timers_.schedule(timeout, [this, id = cmd.id] { expireCommand(id); });
+        }
+        inFlight_.add(entry);
+    }
+
+    endMessage(cmd.id, control);
+
+    // Failing them may queue more commands, which is fine once this one is tracked
+    while (auto const stale = inFlight_.stale(cmd.id)) {
+        failCommand(stale, Error {ErrorType::Timeout, "command got no reply"});
+    }
+    return cmd.id;
+}
+
+auto Transport::publish(PublishRequest &&req, PublishHandler handler)
+        -> outcome::result<std::uint32_t, Error>
+{
+    auto const &outbound = config_.outbound;
+    dropExpired();
+
+    if (outbound.overflow == OverflowPolicy::Wait && (queueFull() || !parked_.empty())) {
+        return park(req, std::move(handler));
+    }
+    if (outbound.overflow == OverflowPolicy::Reject && queueFull()) {
+        return Error {ErrorType::QueueFull, "outbound queue is full"};
+    }
+
+    auto const id = send(std::move(req));
+    pendingMessages_.back().publish = true;
+
+    if (outbound.overflow == OverflowPolicy::DropOldest && outbound.maxBytes > 0
+        && pendingWrites_.size() > outbound.maxBytes) {
+        auto excess = pendingWrites_.size() - outbound.maxBytes;
+        dropMessages(
+                [&](PendingMessage const &message, std::size_t size) {
+                    if (excess == 0 || !message.publish || message.id == id) {
+                        return false;
+                    }
+                    excess -= std::min(excess, size);
+                    return true;
+                },
+                Error {ErrorType::QueueFull, "publish dropped from full outbound queue"});
+    }
+    scheduleExpiry();
+    return id;
+}
+
+// Parked publishes are held to OutboundQueue::maxBytes as well, so Wait holds back at most
+// twice that. Their payload is serialized right away to know its size, and isn't again later.
+auto Transport::park(PublishRequest const &req, PublishHandler &&handler)
+        -> outcome::result<std::uint32_t, Error>
 {
-    if (pendingWrites_.empty()) {
-        pendingWrites_ += j.dump();
+    auto parked = ParkedPublish {};
+    parked.raw = req.raw;
+    if (parked.raw.empty() && req.data && req.data->is_binary()) {
+        parked.data = *req.data;
+    } else if (parked.raw.empty()) {
+        parked.raw = RawJson {req.data ? req.data->dump() : "null"};
+    }
+    parked.bytes = req.channel.size()
+                 + (parked.data.is_binary() ? parked.data.get_binary().size()
+                                            : parked.raw.view().size());
+
+    if (parkedBytes_ + parked.bytes > config_.outbound.maxBytes) {
+        return Error {ErrorType::QueueFull, "outbound queue is full"};
+    }
+    parked.channel = req.channel;
+    parked.handler = std::move(handler);
+    parked.queuedAt = InFlightCommands::Clock::now();
+    parkedBytes_ += parked.bytes;
+    parked_.push_back(std::move(parked));
+    scheduleExpiry();
+    return std::uint32_t {0};
+}
+
+auto Transport::sendPong() -> void
+{
+    if (config_.protocol == Protocol::Protobuf) {
+        protobuf::encodePong(controlWrites_);
     } else {
-        pendingWrites_ += "\n" + j.dump();
+        beginJson(controlWrites_);
+        controlWrites_ += "{}";
     }
 
-    if (cmd.id != 0) {
-        pendingCommands_.push_back(std::move(cmd));
+    endMessage(0, true);
+}
+
+auto Transport::beginJson(std::string &out) -> void
+{
+    // JSON commands in one frame are separated by new lines
+    if (!out.empty()) {
+        out += '\n';
+    }
+}
+
+auto Transport::endMessage(std::uint32_t id, bool control) -> void
+{
+    auto message = PendingMessage {};
+    message.end = control ? controlWrites_.size() : pendingWrites_.size();
+    message.id = id;
+    message.queuedAt = InFlightCommands::Clock::now();
+    (control ? controlMessages_ : pendingMessages_).push_back(message);
+
+    scheduleFlush();
+    updateWatermarks();
+}
+
+auto Transport::queueFull() const -> bool
+{
+    return config_.outbound.maxBytes > 0 && pendingWrites_.size() >= config_.outbound.maxBytes;
+}
+
+template<typename Predicate>
+auto Transport::dropMessages(Predicate &&drop, Error const &reason) -> void
+{
+    // Kept messages are compacted into a new frame, separators included
+    auto const separator = std::size_t {config_.protocol == Protocol::Json ? 1u : 0u};
+    auto kept = std::string {};
+    kept.reserve(pendingWrites_.size());
+    auto dropped = std::vector<std::uint32_t> {};
+    auto start = std::size_t {0};
+    auto count = std::size_t {0};
+    for (auto message : pendingMessages_) {
+        auto const end = message.end;
+        if (drop(message, end - start)) {
+            dropped.push_back(message.id);
+        } else {
+            if (separator > 0 && !kept.empty()) {
+                kept += '\n';
+            }
+            kept.append(pendingWrites_, start, end - start);
+            message.end = kept.size();
+            pendingMessages_[count++] = message;
+        }
+        start = end + separator;
+    }
+    if (dropped.empty()) {
+        return;
+    }
+
+    pendingWrites_ = std::move(kept);
+    pendingMessages_.resize(count);
+    for (auto const id : dropped) {
+        failCommand(id, reason);
+    }
+    updateWatermarks();
+}
+
+auto Transport::dropExpired() -> void
+{
+    auto const ttl = config_.outbound.publishTtl;
+    if (ttl.count() <= 0) {
+        return;
+    }
+
+    // Messages are queued oldest first, nothing has expired while the first one is fresh
+    auto const oldest = InFlightCommands::Clock::now() - ttl;
+    if (!pendingMessages_.empty() && pendingMessages_.front().queuedAt < oldest) {
+        dropMessages(
+                [&](PendingMessage const &message, std::size_t) {
+                    return message.publish && message.queuedAt < oldest;
+                },
+                Error {ErrorType::Timeout, "publish expired in outbound queue"});
+    }
+    while (!parked_.empty() && parked_.front().queuedAt < oldest) {
+        auto parked = std::move(parked_.front());
+        parked_.pop_front();
+        parkedBytes_ -= parked.bytes;
+        auto const error = Error {ErrorType::Timeout, "publish expired in outbound queue"};
+        if (parked.handler) {
+            parked.handler(error);
+        } else {
+            errorSignal_(error);
+        }
+    }
+}
+
+auto Transport::scheduleExpiry() -> void
+{
+    auto const ttl = config_.outbound.publishTtl;
+    if (ttl.count() <= 0 || expiryTimer_ != TimerWheel::NO_TIMER) {
+        return;
+    }
+
+    auto oldest = std::optional<InFlightCommands::Clock::time_point> {};
+    if (!parked_.empty()) {
+        oldest = parked_.front().queuedAt;
+    }
+    // Parked publishes are younger than queued ones
+    for (auto const &message : pendingMessages_) {
+        if (message.publish) {
+            oldest = message.queuedAt;
+            break;
+        }
+    }
+    if (!oldest) {
+        return;
+    }
+
+    auto const left = *oldest + ttl - InFlightCommands::Clock::now();
+    auto const delay = std::max(left, InFlightCommands::Clock::duration::zero());
+    expiryTimer_ = timers_.schedule(delay + chrono::milliseconds {1}, [this] {
+        expiryTimer_ = TimerWheel::NO_TIMER;
+        dropExpired();
+        drainParked();
+        scheduleExpiry();
+    });
+}
+
+auto Transport::drainParked() -> void
+{
+    while (!parked_.empty() && !queueFull()) {
+        auto parked = std::move(parked_.front());
+        parked_.pop_front();
+        parkedBytes_ -= parked.bytes;
+        auto id = std::uint32_t {0};
+        try {
+            auto req = PublishRequest {parked.channel, nullptr, parked.raw};
+            if (parked.raw.empty()) {
+                req.data = &parked.data;
+            }
+            id = send(std::move(req));
+        } catch (nlohmann::json::exception const &e) {
+            auto const error = Error {ErrorType::InvalidJson, e.what()};
+            if (parked.handler) {
+                parked.handler(error);
+            } else {
+                errorSignal_(error);
+            }
+            continue;
+        }
+        pendingMessages_.back().publish = true;
+        pendingMessages_.back().queuedAt = parked.queuedAt;
+        if (parked.handler) {
+            parked.handler(id);
+        }
+    }
+}
+
+auto Transport::updateWatermarks() -> void
+{
+    auto const &outbound = config_.outbound;
+    if (outbound.highWatermark == 0) {
+        return;
     }
 
-    withWs([this](auto &ws) { net::post(ws.get_executor(), [this] { flush(); }); });
+    if (!aboveHighWatermark_ && pendingWrites_.size() > outbound.highWatermark) {
+        aboveHighWatermark_ = true;
+        if (outbound.onHighWatermark) {
+            outbound.onHighWatermark();
+        }
+    } else if (aboveHighWatermark_ && pendingWrites_.size() <= outbound.lowWatermark
+               && parked_.empty()) {
+        aboveHighWatermark_ = false;
+        if (outbound.onLowWatermark) {
+            outbound.onLowWatermark();
+        }
+    }
+}
+
+auto Transport::scheduleFlush() -> void
+{
+    // Everything sent until the flush runs goes out in one frame, a lingering flush is brought
+    // forward once the frame is full or a control message waits
+    auto const full = batchFull() || !controlWrites_.empty();
+    if (flushScheduled_ && !(lingering_ && full)) {
+        return;
+    }
+
+    if (!full && config_.batching.linger.count() > 0) {
+        flushScheduled_ = true;
+        lingering_ = true;
+        lingerTimer_.expires_after(config_.batching.linger);
+        lingerTimer_.async_wait([this](beast::error_code ec) {
+            if (ec) {
+                return;
+            }
+            lingering_ = false;
+            flushScheduled_ = false;
+            flush();
+        });
+        return;
+    }
+
+    if (lingering_) {
+        lingering_ = false;
+        lingerTimer_.cancel();
+    }
+
+    flushScheduled_ = true;
+    net::post(strand_, [this] {
+        flushScheduled_ = false;
+        flush();
+    });
+}
+
+auto Transport::batchFull() const -> bool
+{
+    auto const &batching = config_.batching;
+    return (batching.maxBytes > 0 && pendingWrites_.size() >= batching.maxBytes * batchGrowth_)
+        || (batching.maxMessages > 0
+            && pendingMessages_.size() >= std::size_t {batching.maxMessages} * batchGrowth_);
 }
 
 auto Transport::connect() -> void
 {
     setState(ConnectionState::Connecting, Error {ErrorType::NoError, "connect called"});
 
+    // Replies to commands of a previous connection never arrive
+    failOutstanding(Error {ErrorType::NotConnected, "connection closed"});
+    ++readSerial_;
+    buffer_.clear();
+
     if (token_.empty() && !refreshToken()) {
         return;
     }
@@ -175,6 +609,12 @@ auto Transport::connect() -> void
     } else {
         resetWebSocket<WsStream>(tcp::socket{executor});
     }
+    withWs([this](auto &ws) {
+        ws.binary(config_.protocol == Protocol::Protobuf);
+        if (config_.deflate.enabled) {
+            ws.set_option(toPermessageDeflate(config_.deflate));
+        }
+    });
 
     resolver_.async_resolve(
             urlComponents_.host, urlComponents_.port,
@@ -226,18 +666,8 @@ auto Transport::reconnect(Error const &error) -> void
                             {{"attempt", reconnectAttempts_}, {"delay", delay.count()}}});
     }
 
-    reconnectTimer_.expires_after(delay);
-    reconnectTimer_.async_wait([this](beast::error_code ec) {
-        if (ec) {
-            if (ec == net::error::operation_aborted) {
-                return;
-            }
-            errorSignal_(toError(ec));
-            return;
-        }
-
-        connect();
-    });
+    timers_.cancel(reconnectTimer_);
+    reconnectTimer_ = timers_.schedule(delay, [this] { connect(); });
 }
 
 auto Transport::handShake() -> void
@@ -264,7 +694,7 @@ auto Transport::handShake() -> void
                         }
 
                         withWs([this](auto &ws) {
-                            ws.async_handshake(urlComponents_.host, urlComponents_.path,
+                            ws.async_handshake(urlComponents_.host, handshakeTarget(),
                                                [this](beast::error_code ec) {
                                                    if (ec) {
                                                        errorSignal_(toError(ec));
@@ -277,7 +707,7 @@ auto Transport::handShake() -> void
                         });
                     });
         } else {
-            ws.async_handshake(urlComponents_.host, urlComponents_.path,
+            ws.async_handshake(urlComponents_.host, handshakeTarget(),
                                [this](beast::error_code ec) {
                                    if (ec) {
                                        errorSignal_(toError(ec));
@@ -315,71 +745,204 @@ auto Transport::read() -> void
                 return;
             }
 
-            auto data = beast::buffers_to_string(buffer_.data());
-            buffer_.consume(buffer_.size());
-
-            if (config_.logHandler) {
-                config_.logHandler({LogLevel::Debug, "received message", {{"message", data}}});
-            }
+            auto const bytes = buffer_.cdata();
+            logFrame({static_cast<char const *>(bytes.data()), bytes.size()});
+            handleFrame();
+        });
+    });
+}
 
-            auto ss = std::stringstream {data};
-            auto line = std::string {};
-            while (std::getline(ss, line)) {
-                if (line.empty()) {
-                    continue;
-                }
+auto Transport::logFrame(std::string_view frame) -> void
+{
+    if (!config_.logHandler) {
+        return;
+    }
+    if (config_.protocol == Protocol::Protobuf) {
+        config_.logHandler({LogLevel::Debug, "received message", {{"bytes", frame.size()}}});
+    } else {
+        config_.logHandler({LogLevel::Debug, "received message", {{"message", frame}}});
+    }
+}
 
-                try {
-                    handleReceivedMsg(json::parse(line));
-                } catch (std::exception const &e) {
-                    errorSignal_(Error {ErrorType::TransportError,
-                                        std::string {"json parse error: "} + e.what()});
+// Decodes straight from the read buffer, messages are consumed as they are handled. Past
+// ClientConfig::workBudget messages the rest of the frame is resumed in a later turn and the
+// next frame is read once this one is done.
+auto Transport::handleFrame() -> void
+{
+    auto const bytes = buffer_.cdata();
+    auto frame = std::string_view {static_cast<char const *>(bytes.data()), bytes.size()};
+    auto const budget = config_.workBudget;
+    auto const serial = readSerial_;
+    auto handled = std::size_t {0};
+
+    if (config_.protocol == Protocol::Protobuf) {
+        try {
+            while (!frame.empty() && (budget == 0 || handled < budget)
+                   && serial == readSerial_) {
+                auto const message = protobuf::readDelimited(frame);
+                ++handled;
+                if (message->empty()) {
+                    handlePing();
+                } else {
+                    handleReply(protobuf::decode(
+                            *message, lazyDecode() || rawPayloadRetains_ > 0));
                 }
             }
+        } catch (std::exception const &e) {
+            errorSignal_(Error {ErrorType::TransportError,
+                                std::string {"protobuf decode error: "} + e.what()});
+            frame = {};
+        }
+    } else {
+        while (!frame.empty() && (budget == 0 || handled < budget)
+               && serial == readSerial_) {
+            auto const end = frame.find('\n');
+            auto const line = frame.substr(0, end);
+            frame.remove_prefix(end == std::string_view::npos ? frame.size() : end + 1);
+
+            if (!line.empty()) {
+                ++handled;
+                handleReceivedMsg(line);
+            }
+        }
+    }
+
+    // A handler may have disconnected or started over with a new connection
+    if (serial != readSerial_) {
+        return;
+    }
 
-            read();
+    buffer_.consume(buffer_.size() - frame.size());
+    if (buffer_.size() == 0) {
+        read();
+        return;
+    }
+
+    withWs([this, serial](auto &ws) {
+        net::post(ws.get_executor(), [this, serial] {
+            if (serial == readSerial_) {
+                handleFrame();
+            }
         });
     });
 }
 
-auto Transport::handleReceivedMsg(json const &json) -> void
+auto Transport::handleReceivedMsg(std::string_view message) -> void
 {
-    if (json.empty()) {
-        if (pingTimer_.cancel() == 0) // do not pong if not pinging
-            return;
-
-        startPingTimer();
-        send(json::object());
+    if (isPing(message)) {
+        handlePing();
         return;
     }
 
     try {
-        auto const reply = json.get<Reply>();
-        std::visit(
-                [this](auto const &result) {
-                    using ResultType = std::decay_t<decltype(result)>;
-
-                    if constexpr (std::is_same_v<ResultType, ErrorReply>) {
-                        if (static_cast<ErrorType>(result.code) == ErrorType::TokenExpired) {
-                            token_ = std::string {};
-                            closeConnection();
-                            reconnect();
-                        }
-                    } else if constexpr (std::is_same_v<ResultType, ConnectResult>) {
-                        setState(ConnectionState::Connected, result);
-                    } else if constexpr (std::is_same_v<ResultType, RefreshResult>) {
-                        if (result.expires) {
-                            startTokenRefreshTimer(result.ttl);
-                        }
-                    }
-                },
-                reply.result);
-
-        replyReceivedSignal_(reply);
-        sentCommands_.erase(reply.id);
+        handleReply(decodeReply(message, lazyDecode()));
     } catch (std::exception const &e) {
         errorSignal_(Error {ErrorType::TransportError, std::string {"error processing reply: "}
-                                                               + e.what() + ", " + json.dump()});
+                                                               + e.what() + ", "
+                                                               + std::string {message}});
+    }
+}
+
+auto Transport::handlePing() -> void
+{
+    if (!timers_.cancel(pingTimer_)) // do not pong if not pinging
+        return;
+
+    startPingTimer();
+    sendPong();
+}
+
+auto Transport::handleReply(Reply const &reply) -> void
+{
+    std::visit(
+            [this, &reply](auto const &result) {
+                using ResultType = std::decay_t<decltype(result)>;
+
+                if constexpr (std::is_same_v<ResultType, ErrorReply>) {
+                    // The server may not take subscriptions in connect, the next one goes without
+                    if (reply.id == connectCommandId_ && connectWithSubs_
+                        && rejectsSubs(static_cast<ErrorType>(result.code))) {
+                        connectSubsRejected_ = true;
+                    }
+                    if (static_cast<ErrorType>(result.code) == ErrorType::TokenExpired) {
+                        token_ = std::string {};
+                        closeConnection();
+                        reconnect();
+                    }
+                } else if constexpr (std::is_same_v<ResultType, ConnectResult>) {
+                    // The server behind the URL may change, the next connect tries again
+                    connectSubsRejected_ = false;
+                    setState(ConnectionState::Connected, result);
+                } else if constexpr (std::is_same_v<ResultType, RefreshResult>) {
+                    if (result.expires) {
+                        startTokenRefreshTimer(result.ttl);
+                    }
+                }
+            },
+            reply.result);
+
+    if (auto const entry = inFlight_.complete(reply.id)) {
+        timers_.cancel(entry->deadline);
+    }
+    replyReceivedSignal_(reply);
+}
+
+auto Transport::expireCommand(std::uint32_t id) -> void
+{
+    if (!inFlight_.complete(id)) {
+        return;
+    }
+
+    // Owners of the command get it as a temporary error reply, like any other failure
+    auto reply = Reply {};
+    reply.id = id;
+    reply.result = ErrorReply {static_cast<std::uint32_t>(ErrorType::Timeout),
+                               "command timed out", true, true};
+
+    if (id == connectCommandId_) {
+        closeConnection();
+        reconnect(Error {ErrorType::Timeout, "connect command timed out"});
+    }
+    replyReceivedSignal_(reply);
+}
+
+auto Transport::failCommand(std::uint32_t id, Error const &reason) -> void
+{
+    auto const entry = inFlight_.complete(id);
+    if (!entry) {
+        return;
+    }
+    timers_.cancel(entry->deadline);
+
+    auto reply = Reply {};
+    reply.id = id;
+    reply.result = ErrorReply {static_cast<std::uint32_t>(reason.ec.value()), reason.message, true};
+    replyReceivedSignal_(reply);
+}
+
+// Nothing queued for a connection goes out on the next one: its subscribes would go next to the
+// ones sent afresh, and its publishes would no longer be tracked. Owners hear of every command
+// like of any other failure.
+auto Transport::failOutstanding(Error const &reason) -> void
+{
+    controlWrites_.clear();
+    controlMessages_.clear();
+    pendingWrites_.clear();
+    pendingMessages_.clear();
+    auto parked = std::exchange(parked_, {});
+    parkedBytes_ = 0;
+    updateWatermarks();
+
+    // Ids are taken first, failing a command may send others
+    for (auto const id : inFlight_.ids()) {
+        failCommand(id, reason);
+    }
+    for (auto &publish : parked) {
+        if (publish.handler) {
+            publish.handler(reason);
+        } else {
+            errorSignal_(reason);
+        }
     }
 }
 
@@ -389,28 +952,102 @@ auto Transport::sendConnectCmd() -> void
     req.token = token_;
     req.name = config_.name.empty() ? "cpp" : config_.name;
     req.version = config_.version;
-    send(makeCommand(req));
+    if (!connectSubsRejected_) {
+        connectRequestSignal_(req);
+    }
+    connectWithSubs_ = !req.subs.empty();
+    connectCommandId_ = send(std::move(req));
 }
 
 auto Transport::flush() -> void
 {
-    if (isWriting_ || pendingWrites_.empty()) {
+    if (isWriting_) {
+        return;
+    }
+    dropExpired();
+    if (pendingWrites_.empty() && controlWrites_.empty()) {
         return;
     }
 
-    auto const messages = std::move(pendingWrites_);
-    auto const commands = std::move(pendingCommands_);
-    pendingWrites_.clear();
-    pendingCommands_.clear();
+    // Control messages all go first, then as many whole data messages as the caps allow, at
+    // least one
+    auto const &batching = config_.batching;
+    auto count = pendingMessages_.size();
+    if (batching.maxMessages > 0) {
+        count = std::min(count, std::size_t {batching.maxMessages} * batchGrowth_);
+    }
+    if (batching.maxBytes > 0 && count > 0) {
+        auto const fits = std::upper_bound(
+                pendingMessages_.begin(), pendingMessages_.begin() + count,
+                batching.maxBytes * batchGrowth_,
+                [](std::size_t bytes, PendingMessage const &message) {
+                    return bytes < message.end;
+                });
+        count = std::max<std::size_t>(1, fits - pendingMessages_.begin());
+    }
+
+    auto const now = InFlightCommands::Clock::now();
+    recordDelays(writeStats_.control, controlMessages_.begin(), controlMessages_.end(), now);
+    recordDelays(writeStats_.data, pendingMessages_.begin(), pendingMessages_.begin() + count, now);
+    auto const controlCount = controlMessages_.size();
+    controlMessages_.clear();
+
+    // The frame has to outlive the write, the pending buffers keep collecting the next one
+    writingControl_.clear();
+    std::swap(writingControl_, controlWrites_);
+    if (count == pendingMessages_.size()) {
+        writing_.clear();
+        std::swap(writing_, pendingWrites_);
+        pendingMessages_.clear();
+    } else {
+        auto const end = pendingMessages_[count - 1].end;
+        // The rest of a JSON frame starts with the separator of its first message
+        auto const consumed = end + (config_.protocol == Protocol::Json ? 1 : 0);
+        writing_.assign(pendingWrites_, 0, end);
+        pendingWrites_.erase(0, consumed);
+        pendingMessages_.erase(pendingMessages_.begin(), pendingMessages_.begin() + count);
+        for (auto &message : pendingMessages_) {
+            message.end -= consumed;
+        }
+    }
+
+    if (batching.adaptive) {
+        batchGrowth_ = pendingMessages_.empty() ? 1
+                                                : std::min<std::uint32_t>(batchGrowth_ * 2, 16);
+    }
+
+    // Room was made for publishes held back
+    drainParked();
+    updateWatermarks();
+
+    ++writeStats_.frames;
+    writeStats_.messages += controlCount + count;
+    writeStats_.lastFrameMessages = static_cast<std::uint32_t>(controlCount + count);
+
+    // Both lanes go out as one WebSocket message
+    auto const separated = config_.protocol == Protocol::Json && !writingControl_.empty()
+                        && !writing_.empty();
+    auto const frame = std::array<net::const_buffer, 3> {
+            net::buffer(writingControl_), net::const_buffer {"\n", separated ? 1u : 0u},
+            net::buffer(writing_)};
 
     if (config_.logHandler) {
-        config_.logHandler({LogLevel::Debug, "sending message", {{"message", messages}}});
+        if (config_.protocol == Protocol::Protobuf) {
+            config_.logHandler({LogLevel::Debug,
+                                "sending message",
+                                {{"bytes", net::buffer_size(frame)},
+                                 {"messages", writeStats_.lastFrameMessages}}});
+        } else {
+            config_.logHandler({LogLevel::Debug,
+                                "sending message",
+                                {{"message", beast::buffers_to_string(frame)},
+                                 {"messages", writeStats_.lastFrameMessages}}});
+        }
     }
 
     isWriting_ = true;
     withWs([&](auto &ws) {
-        ws.async_write(net::buffer(messages), [this, cmds = std::move(commands)](
-                                                      beast::error_code ec, std::size_t) mutable {
+        ws.async_write(frame, [this](beast::error_code ec, std::size_t) {
             isWriting_ = false;
 
             if (ec) {
@@ -418,17 +1055,21 @@ auto Transport::flush() -> void
                 return;
             }
 
-            for (auto &cmd : cmds) {
-                sentCommands_.emplace(cmd.id, std::move(cmd));
-            }
-
-            if (!pendingWrites_.empty()) {
+            if (!pendingWrites_.empty() || !controlWrites_.empty()) {
                 flush();
             }
         });
     });
 }
 
+auto Transport::handshakeTarget() const -> std::string
+{
+    if (config_.protocol == Protocol::Protobuf) {
+        return urlComponents_.path + "?format=protobuf";
+    }
+    return urlComponents_.path;
+}
+
 auto Transport::refreshToken() -> bool
 {
     if (!config_.getToken) {
@@ -461,18 +1102,9 @@ auto Transport::closeConnection() -> void
 
 auto Transport::startPingTimer() -> void
 {
-    pingTimer_.expires_after(pingInterval_);
-    pingTimer_.async_wait([this](boost::system::error_code ec) {
-        if (ec) {
-            if (ec == net::error::operation_aborted) {
-                return;
-            }
-            errorSignal_(toError(ec));
-            return;
-        }
-
-        reconnect(Error {ErrorType::NoPing, "no ping"});
-    });
+    timers_.cancel(pingTimer_);
+    pingTimer_ = timers_.schedule(pingInterval_,
+                                  [this] { reconnect(Error {ErrorType::NoPing, "no ping"}); });
 }
 
 auto Transport::startTokenRefreshTimer(std::uint32_t ttlSeconds) -> void
@@ -482,21 +1114,13 @@ auto Transport::startTokenRefreshTimer(std::uint32_t ttlSeconds) -> void
         expiryTime -= config_.refreshTokenBeforeExpiry;
     }
 
-    tokenRefreshTimer_.expires_after(expiryTime);
-    tokenRefreshTimer_.async_wait([this](boost::system::error_code ec) {
-        if (ec) {
-            if (ec == net::error::operation_aborted) {
-                return;
-            }
-            errorSignal_(toError(ec));
-            return;
-        }
-
+    timers_.cancel(tokenRefreshTimer_);
+    tokenRefreshTimer_ = timers_.schedule(expiryTime, [this] {
         if (!refreshToken()) {
             return;
         }
 
-        send(makeCommand(RefreshRequest {token_}));
+        send(RefreshRequest {token_});
     });
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <chrono>
+#include <deque>
 #include <optional>
 #include <random>
 #include <variant>
@@ -20,6 +21,8 @@
 #include <centrifugo/error.h>
 #include <utility>
 #include "protocol_all.h"
+#include "inflight_commands.h"
+#include "timer_wheel.h"
 
 namespace centrifugo {
 
@@ -46,33 +49,48 @@ public:
     using DisconnectedSignal = boost::signals2::signal<void(Error const &)>;
     using ReplyReceivedSignal = boost::signals2::signal<void(Reply const &)>;
     using ErrorSignal = boost::signals2::signal<void(Error const &)>;
+    using ConnectRequestSignal = boost::signals2::signal<void(ConnectRequest &)>;
+    // Outcome of a publish held back by OverflowPolicy::Wait: its id once queued, or why it
+    // never was
+    using PublishHandler = std::function<void(outcome::result<std::uint32_t, Error>)>;
 
     Transport(net::strand<net::io_context::executor_type> const &strand, std::string &&url,
               ClientConfig &&config);
 
     auto state() const -> ConnectionState;
-    auto sentCommands() const -> std::unordered_map<std::uint32_t, Command> const &;
+    auto config() const -> ClientConfig const & { return config_; }
+    auto inFlight() const -> InFlightCommands const & { return inFlight_; }
+    auto writeStats() const -> WriteStats const & { return writeStats_; }
 
     auto initialConnect() -> outcome::result<void, Error>;
     auto disconnect(Error const &error = {ErrorType::NoError, "disconnect called"}) -> void;
 
-    template<typename T>
-    auto send(T &&message) -> void
+    // Queues req as a command with the next id of this transport and returns that id
+    auto send(Command::RequestType &&req) -> std::uint32_t;
+    // Like send() but held to ClientConfig::outbound. Returns 0 for a publish held back by
+    // OverflowPolicy::Wait, handler then gets its id once it is queued or the error it failed
+    // with; without a handler the error goes to onError().
+    auto publish(PublishRequest &&req, PublishHandler handler = {})
+            -> outcome::result<std::uint32_t, Error>;
+
+    // Protobuf delta subscriptions apply deltas to the payload bytes as received, while any of
+    // them holds a retain publications are decoded lazily and parsed on delivery
+    auto retainRawPayloads() -> void { ++rawPayloadRetains_; }
+    auto releaseRawPayloads() -> void { --rawPayloadRetains_; }
+    // Payloads are parsed on delivery rather than when decoding, which dispatch workers do
+    auto lazyDecode() const -> bool
     {
-        if constexpr (std::is_same_v<std::decay_t<T>, Command>) {
-            send(json(message), std::forward<T>(message));
-        } else {
-            send(json(message), Command {});
-        }
+        return config_.lazyPublicationData || config_.dispatchWorkers > 0;
     }
 
-    auto send(json const &j, Command &&cmd) -> void;
-
     auto onConnecting() -> ConnectingSignal & { return connectingSignal_; }
     auto onConnected() -> ConnectedSignal & { return connectedSignal_; }
     auto onDisconnected() -> DisconnectedSignal & { return disconnectedSignal_; }
     auto onReplyReceived() -> ReplyReceivedSignal & { return replyReceivedSignal_; }
     auto onError() -> ErrorSignal & { return errorSignal_; }
+    // Lets subscriptions add themselves to ConnectRequest::subs to be recovered or subscribed
+    // within the connect round trip
+    auto onConnectRequest() -> ConnectRequestSignal & { return connectRequestSignal_; }
     auto onSslContextConfigure(std::function<bool(boost::asio::ssl::context &sslContext)> callback)
             -> void
     {
@@ -84,9 +102,31 @@ private:
     auto reconnect(Error const &reason = {}) -> void;
     auto handShake() -> void;
     auto read() -> void;
-    auto handleReceivedMsg(json const &json) -> void;
+    auto handleFrame() -> void;
+    auto logFrame(std::string_view frame) -> void;
+    auto handleReceivedMsg(std::string_view message) -> void;
+    auto handlePing() -> void;
+    auto handleReply(Reply const &reply) -> void;
+    auto expireCommand(std::uint32_t id) -> void;
+    auto failCommand(std::uint32_t id, Error const &reason) -> void;
     auto sendConnectCmd() -> void;
+    auto sendPong() -> void;
+    auto beginJson(std::string &out) -> void;
+    auto endMessage(std::uint32_t id, bool control) -> void;
+    auto queueFull() const -> bool;
+    template<typename Predicate>
+    auto dropMessages(Predicate &&drop, Error const &reason) -> void;
+    auto dropExpired() -> void;
+    auto scheduleExpiry() -> void;
+    auto park(PublishRequest const &req, PublishHandler &&handler)
+            -> outcome::result<std::uint32_t, Error>;
+    auto drainParked() -> void;
+    auto failOutstanding(Error const &reason) -> void;
+    auto updateWatermarks() -> void;
+    auto scheduleFlush() -> void;
+    auto batchFull() const -> bool;
     auto flush() -> void;
+    auto handshakeTarget() const -> std::string;
     auto refreshToken() -> bool;
     auto closeConnection() -> void;
     auto startPingTimer() -> void;
@@ -138,13 +178,19 @@ private:
     ClientConfig config_;
     std::string url_;
 
+    // Posting to the strand itself rather than the type-erased executor of the stream doesn't
+    // allocate
+    net::strand<net::io_context::executor_type> strand_;
     tcp::resolver resolver_;
     std::optional<net::ssl::context> sslContext_;
     WebSocketVariant ws_;
     beast::flat_buffer buffer_;
-    net::steady_timer reconnectTimer_;
-    net::steady_timer pingTimer_;
-    net::steady_timer tokenRefreshTimer_;
+    // Bumped per connection, a frame resumed in a later turn is dropped if its connection is gone
+    std::uint32_t readSerial_ = 0;
+    TimerWheel timers_;
+    TimerWheel::TimerId reconnectTimer_ = TimerWheel::NO_TIMER;
+    TimerWheel::TimerId pingTimer_ = TimerWheel::NO_TIMER;
+    TimerWheel::TimerId tokenRefreshTimer_ = TimerWheel::NO_TIMER;
     std::mt19937 rng_;
 
     ConnectionState state_ = ConnectionState::Disconnected;
@@ -152,19 +198,60 @@ private:
     std::string clientId_;
     chrono::seconds pingInterval_;
     std::uint32_t reconnectAttempts_ = 0;
-    std::unordered_map<std::uint32_t, Command> sentCommands_;
+    std::uint32_t lastCommandId_ = 0;
+    std::uint32_t connectCommandId_ = 0;
+    bool connectWithSubs_ = false;
+    bool connectSubsRejected_ = false;
+    InFlightCommands inFlight_;
     std::string token_;
+    std::uint32_t rawPayloadRetains_ = 0;
+
+    struct PendingMessage {
+        // Offset just past the message in pendingWrites_
+        std::size_t end {0};
+        // Command id, 0 for a pong
+        std::uint32_t id {0};
+        bool publish {false};
+        InFlightCommands::Clock::time_point queuedAt;
+    };
+
+    // Parked publishes outlive the call which borrowed channel and data, they own them
+    struct ParkedPublish {
+        std::string channel;
+        // Binary payloads only, the others are serialized into raw
+        nlohmann::json data;
+        RawJson raw;
+        PublishHandler handler;
+        // Counted against OutboundQueue::maxBytes
+        std::size_t bytes {0};
+        InFlightCommands::Clock::time_point queuedAt;
+    };
 
-    // deferred writes
+    // deferred writes, control messages have a lane of their own which always goes out first
+    std::string controlWrites_;
+    std::string writingControl_;
+    std::vector<PendingMessage> controlMessages_;
     std::string pendingWrites_;
-    std::vector<Command> pendingCommands_;
+    std::string writing_;
+    std::vector<PendingMessage> pendingMessages_;
+    std::deque<ParkedPublish> parked_;
+    std::size_t parkedBytes_ = 0;
+    // Expires publishes past OutboundQueue::publishTtl while nothing is published or flushed
+    TimerWheel::TimerId expiryTimer_ = TimerWheel::NO_TIMER;
+    bool aboveHighWatermark_ = false;
+    net::steady_timer lingerTimer_;
+    std::uint32_t batchGrowth_ = 1;
     bool isWriting_ = false;
+    bool flushScheduled_ = false;
+    bool lingering_ = false;
+    WriteStats writeStats_;
 
     ConnectingSignal connectingSignal_;
     ConnectedSignal connectedSignal_;
     DisconnectedSignal disconnectedSignal_;
     ReplyReceivedSignal replyReceivedSignal_;
     ErrorSignal errorSignal_;
+    ConnectRequestSignal connectRequestSignal_;
 
     std::function<bool(boost::asio::ssl::context &)> sslContextConfigureCallback_;
 };
@@ -0,0 +1,88 @@
+// Applies hand made fossil deltas: copies, literals and the checks which reject a delta that is
+// malformed, doesn't fit its source or fails its checksum.
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "fossil_delta.h"
+
+using namespace centrifugo;
+
+namespace {
+
+auto failed = false;
+
+auto check(bool ok, char const *what) -> void
+{
+    if (!ok) {
+        std::printf("failed: %s\n", what);
+        failed = true;
+    }
+}
+
+// Integer in the base-64 digits of the format
+auto digits(std::uint64_t value) -> std::string
+{
+    constexpr auto alphabet = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ_abcdefghijklmnopqrstuvwxyz~";
+    auto out = std::string {};
+    do {
+        out.insert(out.begin(), alphabet[value & 63]);
+        value >>= 6;
+    } while (value > 0);
+    return out;
+}
+
+// Written out here rather than shared with the decoder, so a mistake in it can't hide
+auto checksum(std::string const &data) -> std::uint32_t
+{
+    auto padded = data;
+    padded.resize((data.size() + 3) / 4 * 4, '\0');
+    auto sum = std::uint32_t {0};
+    for (auto i = std::size_t {0}; i < padded.size(); i += 4) {
+        sum += static_cast<std::uint32_t>(static_cast<unsigned char>(padded[i])) << 24
+             | static_cast<std::uint32_t>(static_cast<unsigned char>(padded[i + 1])) << 16
+             | static_cast<std::uint32_t>(static_cast<unsigned char>(padded[i + 2])) << 8
+             | static_cast<std::uint32_t>(static_cast<unsigned char>(padded[i + 3]));
+    }
+    return sum;
+}
+
+auto const SOURCE = std::string {R"({"game":"pinball","machine":1042,"scores":[1250000,830000]})"};
+auto const TARGET = std::string {R"({"game":"pinball","machine":1042,"scores":[1250000,845000]})"};
+
+// TARGET as a copy of the start of SOURCE, a literal and a copy of its end
+auto delta(std::uint64_t size, std::uint32_t sum) -> std::string
+{
+    return digits(size) + '\n' + digits(51) + "@0," + digits(3) + ":845" + digits(5) + '@'
+           + digits(54) + ',' + digits(sum) + ';';
+}
+
+}
+
+int main()
+{
+    auto const sum = checksum(TARGET);
+    check(fossil::applyDelta(SOURCE, delta(TARGET.size(), sum)) == TARGET, "copies and literal");
+    check(fossil::applyDelta(SOURCE, delta(TARGET.size(), sum + 1)) == std::nullopt,
+          "checksum mismatch accepted");
+    check(fossil::applyDelta(SOURCE, delta(TARGET.size() + 1, sum)) == std::nullopt,
+          "wrong target size accepted");
+    check(fossil::applyDelta(SOURCE.substr(0, 40), delta(TARGET.size(), sum)) == std::nullopt,
+          "copy past the end of the source accepted");
+
+    auto const literal = std::string {"scoreboard"};
+    auto const whole = digits(literal.size()) + '\n' + digits(literal.size()) + ':' + literal
+                     + digits(checksum(literal)) + ';';
+    check(fossil::applyDelta({}, whole) == literal, "literal only");
+    check(fossil::applyDelta({}, "0\n0;") == std::string {}, "empty target");
+
+    check(!fossil::applyDelta({}, whole.substr(0, whole.size() - 1)), "missing terminator");
+    check(!fossil::applyDelta({}, digits(literal.size()) + '\n' + digits(20) + ':' + literal),
+          "literal past the end accepted");
+    check(!fossil::applyDelta(SOURCE, digits(4) + "\n4@0;"), "copy without a comma accepted");
+    check(!fossil::applyDelta(SOURCE, digits(4) + "4@0,0;"), "size without a newline accepted");
+    check(!fossil::applyDelta(SOURCE, digits(4) + "\n4?0,0;"), "unknown command accepted");
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+// Drives the ring of InFlightCommands: growth, replies out of order, ids that never got queued,
+// wrapping ids, stale entries and ids which aren't in flight.
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "inflight_commands.h"
+
+using namespace centrifugo;
+
+namespace {
+
+auto failed = false;
+
+auto check(bool ok, char const *what) -> void
+{
+    if (!ok) {
+        std::printf("failed: %s\n", what);
+        failed = true;
+    }
+}
+
+auto entry(std::uint32_t id) -> InFlightCommands::Entry
+{
+    auto e = InFlightCommands::Entry {};
+    e.id = id;
+    e.requestType = static_cast<std::uint8_t>(id % 6);
+    e.deadline = id * 10;
+    return e;
+}
+
+}
+
+int main()
+{
+    // Past the initial capacity, completed from the newest down
+    auto commands = InFlightCommands {};
+    for (auto id = std::uint32_t {1}; id <= 200; ++id) {
+        commands.add(entry(id));
+    }
+    check(commands.size() == 200, "entries lost while growing");
+    auto const *found = commands.find(150);
+    check(found && found->requestType == 150 % 6 && found->deadline == 1500, "metadata lost");
+    for (auto id = std::uint32_t {200}; id > 100; --id) {
+        check(commands.complete(id).has_value(), "entry missing");
+    }
+    check(!commands.complete(150) && !commands.find(150), "completed twice");
+    check(!commands.find(0) && !commands.find(201), "found an id never added");
+    check(commands.ids().size() == 100 && commands.ids().front() == 1, "ids() wrong");
+
+    // Front entries go, the ring wraps around its storage without growing
+    for (auto id = std::uint32_t {1}; id <= 100; ++id) {
+        commands.complete(id);
+    }
+    check(commands.empty(), "entries left after completing all");
+    for (auto id = std::uint32_t {300}; id < 1200; id += 3) {
+        commands.add(entry(id));
+        if (id >= 330) {
+            commands.complete(id - 30);
+        }
+    }
+    auto expected = std::vector<std::uint32_t> {};
+    for (auto id = std::uint32_t {1170}; id < 1200; id += 3) {
+        expected.push_back(id);
+    }
+    check(commands.ids() == expected, "ids skipped by callers or out of order");
+
+    // A reply to the oldest command never came
+    auto lost = InFlightCommands {};
+    lost.add(entry(7));
+    lost.add(entry(8));
+    check(lost.stale(7 + InFlightCommands::MAX_SPAN - 1) == 0, "stale too early");
+    check(lost.stale(7 + InFlightCommands::MAX_SPAN) == 7, "stale entry not reported");
+    lost.complete(7);
+    check(lost.stale(7 + InFlightCommands::MAX_SPAN) == 0, "completed entry reported stale");
+
+    // Ids wrap around, 0 is never handed out
+    auto wrapping = InFlightCommands {};
+    wrapping.add(entry(0xfffffffe));
+    wrapping.add(entry(0xffffffff));
+    wrapping.add(entry(1));
+    check(wrapping.find(0xffffffff) && wrapping.find(1) && !wrapping.find(0), "wrapped ids lost");
+    wrapping.complete(0xfffffffe);
+    wrapping.complete(0xffffffff);
+    check(wrapping.ids() == std::vector<std::uint32_t> {1}, "wrapped front not released");
+
+    wrapping.clear();
+    check(wrapping.empty() && !wrapping.find(1), "clear() kept entries");
+    wrapping.add(entry(42));
+    check(wrapping.find(42) && wrapping.size() == 1, "adding after clear() failed");
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+// Decodes replies with ClientConfig::lazyPublicationData and without, payloads have to come out
+// the same. The replies nest "data" keys, brackets, quotes and escapes where a text scan trips.
+
+#include <cstdio>
+#include <string>
+#include <variant>
+
+#include "protocol_all.h"
+
+using namespace centrifugo;
+using json = nlohmann::json;
+
+namespace {
+
+auto failed = false;
+
+auto check(bool ok, char const *what) -> void
+{
+    if (!ok) {
+        std::printf("failed: %s\n", what);
+        failed = true;
+    }
+}
+
+auto publications(Reply const &reply) -> std::vector<Publication>
+{
+    if (auto const *push = std::get_if<Push>(&reply.result)) {
+        if (auto const *pub = std::get_if<Publication>(&push->type)) {
+            return {*pub};
+        }
+    }
+    if (auto const *result = std::get_if<SubscribeResult>(&reply.result)) {
+        return result->publications;
+    }
+    return {};
+}
+
+// Publications decoded both ways, true if they all match
+auto same(char const *message) -> bool
+{
+    auto const eager = publications(decodeReply(message));
+    auto const lazy = publications(decodeReply(message, true));
+    if (eager.empty() || eager.size() != lazy.size()) {
+        return false;
+    }
+    for (auto i = std::size_t {0}; i < eager.size(); ++i) {
+        auto const &a = eager[i];
+        auto const &b = lazy[i];
+        if (a.payload() != b.payload() || a.offset != b.offset || a.tags != b.tags
+            || a.info.has_value() != b.info.has_value()
+            || (a.info && a.info->user != b.info->user)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+int main()
+{
+    check(same(R"({"push":{"channel":"news","pub":{"data":{"data":{"text":"\"data\":[}"},"n":1},)"
+               R"("info":{"user":"42","client":"c","conn_info":{"data":7},)"
+               R"("chan_info":{"data":"x"}},)"
+               R"("offset":5}}})"),
+          "nested data keys");
+    check(same(R"({"push":{"channel":"news","pub":{"data" : 42 ,"offset":1}}})"), "number payload");
+    check(same(R"({"push":{"channel":"news","pub":{"offset":1,"data":-1.5e3}}})"),
+          "payload last in its object");
+    check(same(R"({"push":{"channel":"news","pub":{"d\u0061ta":{"n":1},"offset":2}}})"),
+          "escaped data key");
+    check(same(R"({"push":{"channel":"news","pub":{"tags":{"data":"t"},"data":true}}})"),
+          "data key in tags");
+    check(same(R"({"id":3,"subscribe":{"publications":[{"data":"a}\\","offset":1},)"
+               R"({"data":[1,{"data":[]},"]"],"offset":2},{"data":null,"offset":3}]}})"),
+          "subscribe publications");
+
+    auto const lazy =
+            publications(decodeReply(R"({"push":{"channel":"news","pub":{"data":[1, 2]}}})", true));
+    check(lazy.size() == 1 && lazy[0].rawData == "[1, 2]", "raw bytes not kept as sent");
+
+    auto const connect =
+            decodeReply(R"({"id":1,"connect":{"client":"c","data":{"motd":"hi"}}})", true);
+    auto const *result = std::get_if<ConnectResult>(&connect.result);
+    check(result && result->data == std::string {R"({"motd":"hi"})"}, "connect data");
+
+    return failed ? 1 : 0;
+}
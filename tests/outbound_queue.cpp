@@ -0,0 +1,200 @@
+// Holds publishes to ClientConfig::outbound on a transport which never connects, so nothing
+// leaves the queue but what the overflow policies, watermarks and publish TTL take out of it.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/strand.hpp>
+
+#include "transport.h"
+
+using namespace centrifugo;
+
+namespace {
+
+constexpr auto MAX_BYTES = std::size_t {400};
+constexpr auto PUBLISHES = 40;
+auto const CHANNEL = std::string {"scoreboard:pinball-machine-1042"};
+auto const DATA = RawJson {R"({"game":"pinball","machine":1042})"};
+
+auto failed = false;
+
+auto check(bool ok, char const *what) -> void
+{
+    if (!ok) {
+        std::printf("failed: %s\n", what);
+        failed = true;
+    }
+}
+
+auto code(ErrorType type) -> std::uint32_t
+{
+    return static_cast<std::uint32_t>(type);
+}
+
+// Transport of its own io_context, which is never run
+class Queue
+{
+public:
+    explicit Queue(OutboundQueue outbound)
+        : transport_ {net::make_strand(io_), "ws://127.0.0.1:1/connection", config(outbound)}
+    {
+        transport_.onReplyReceived().connect([this](Reply const &reply) {
+            if (auto const *error = std::get_if<ErrorReply>(&reply.result)) {
+                failures.emplace_back(reply.id, error->code);
+            }
+        });
+    }
+
+    auto publish(Transport::PublishHandler handler = {}) -> outcome::result<std::uint32_t, Error>
+    {
+        return transport_.publish(PublishRequest {CHANNEL, nullptr, DATA}, std::move(handler));
+    }
+
+    auto transport() -> Transport & { return transport_; }
+
+    // Ids and error codes of the publishes which failed
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> failures;
+
+private:
+    static auto config(OutboundQueue const &outbound) -> ClientConfig
+    {
+        auto config = ClientConfig {};
+        config.outbound = outbound;
+        return config;
+    }
+
+    net::io_context io_;
+    Transport transport_;
+};
+
+auto bounded(OverflowPolicy overflow) -> OutboundQueue
+{
+    auto outbound = OutboundQueue {};
+    outbound.maxBytes = MAX_BYTES;
+    outbound.overflow = overflow;
+    return outbound;
+}
+
+auto reject() -> void
+{
+    auto queue = Queue {bounded(OverflowPolicy::Reject)};
+    auto accepted = std::size_t {0};
+    auto rejected = 0;
+    for (auto i = 0; i < PUBLISHES; ++i) {
+        if (auto const result = queue.publish()) {
+            ++accepted;
+            check(rejected == 0, "Reject: publish accepted after one was rejected");
+        } else {
+            ++rejected;
+            check(result.assume_error().ec == ErrorType::QueueFull, "Reject: wrong error");
+        }
+    }
+    check(accepted > 1 && rejected > 0, "Reject: bound not applied");
+    check(queue.transport().inFlight().size() == accepted, "Reject: rejected publish tracked");
+    check(queue.failures.empty(), "Reject: queued publish failed");
+}
+
+auto dropOldest() -> void
+{
+    auto queue = Queue {bounded(OverflowPolicy::DropOldest)};
+    auto newest = std::uint32_t {0};
+    for (auto i = 0; i < PUBLISHES; ++i) {
+        auto const result = queue.publish();
+        check(bool {result}, "DropOldest: publish failed");
+        newest = result ? result.assume_value() : newest;
+    }
+
+    // The oldest ones made room, in the order they were queued
+    check(!queue.failures.empty(), "DropOldest: nothing dropped");
+    for (auto i = std::size_t {0}; i < queue.failures.size(); ++i) {
+        check(queue.failures[i].first == i + 1, "DropOldest: dropped out of order");
+        check(queue.failures[i].second == code(ErrorType::QueueFull), "DropOldest: wrong error");
+    }
+    check(queue.transport().inFlight().find(newest) != nullptr, "DropOldest: newest dropped");
+    check(queue.transport().inFlight().size() + queue.failures.size() == PUBLISHES,
+          "DropOldest: publishes unaccounted for");
+}
+
+auto waitAndExpire() -> void
+{
+    auto outbound = bounded(OverflowPolicy::Wait);
+    outbound.publishTtl = std::chrono::milliseconds {200};
+    auto queue = Queue {outbound};
+
+    auto queued = std::size_t {0};
+    auto parked = 0;
+    auto full = 0;
+    auto expired = 0;
+    for (auto i = 0; i < PUBLISHES; ++i) {
+        auto const result = queue.publish([&](outcome::result<std::uint32_t, Error> outcome) {
+            check(!outcome && outcome.assume_error().ec == ErrorType::Timeout,
+                  "Wait: parked publish didn't expire");
+            ++expired;
+        });
+        if (!result) {
+            check(result.assume_error().ec == ErrorType::QueueFull, "Wait: wrong error");
+            ++full;
+        } else if (result.assume_value() == 0) {
+            check(full == 0, "Wait: publish parked after one was refused");
+            ++parked;
+        } else {
+            check(parked == 0, "Wait: publish queued ahead of parked ones");
+            ++queued;
+        }
+    }
+    check(queued > 0 && parked > 0 && full > 0, "Wait: bound not applied");
+
+    // The next publish finds the queue and the parked ones expired
+    std::this_thread::sleep_for(std::chrono::milliseconds {250});
+    auto const fresh = queue.publish();
+    check(fresh && fresh.assume_value() > 0, "Wait: publish not queued after the rest expired");
+    check(expired == parked, "Wait: parked publishes left");
+    check(queue.failures.size() == queued, "Wait: queued publishes left");
+    for (auto const &[id, error] : queue.failures) {
+        check(error == code(ErrorType::Timeout), "Wait: queued publish failed wrongly");
+    }
+    check(queue.transport().inFlight().size() == 1, "Wait: expired publishes tracked");
+}
+
+auto watermarks() -> void
+{
+    auto outbound = OutboundQueue {};
+    outbound.highWatermark = 300;
+    outbound.lowWatermark = 100;
+    outbound.publishTtl = std::chrono::milliseconds {200};
+    auto high = 0;
+    auto low = 0;
+    outbound.onHighWatermark = [&] { ++high; };
+    outbound.onLowWatermark = [&] { ++low; };
+    auto queue = Queue {outbound};
+
+    for (auto i = 0; i < PUBLISHES; ++i) {
+        check(bool {queue.publish()}, "publish to unbounded queue failed");
+    }
+    check(high == 1 && low == 0, "high watermark not called once");
+
+    // Expiry empties the queue, the publish queued then stays under the low watermark
+    std::this_thread::sleep_for(std::chrono::milliseconds {250});
+    check(bool {queue.publish()}, "publish after expiry failed");
+    check(high == 1 && low == 1, "low watermark not called once");
+    for (auto i = 0; i < PUBLISHES; ++i) {
+        check(bool {queue.publish()}, "publish to unbounded queue failed");
+    }
+    check(high == 2 && low == 1, "high watermark not called again");
+}
+
+}
+
+int main()
+{
+    reject();
+    dropOldest();
+    waitAndExpire();
+    watermarks();
+    return failed ? 1 : 0;
+}
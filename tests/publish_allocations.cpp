@@ -0,0 +1,142 @@
+// Publishes through Client and Subscription to a local stand-in for Centrifugo and counts the
+// heap allocations of the publishing thread while publishes are queued: encoding, in-flight
+// tracking, reply routes, deadlines and scheduling the flush. Once warmed up by earlier rounds
+// a publish must not allocate, the test fails otherwise.
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/strand.hpp>
+#include <nlohmann/json.hpp>
+
+#include <centrifugo.h>
+#include "stub_server.h"
+
+// Replacing operator new with malloc() and operator delete with free() is fine, GCC can't tell
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+using namespace centrifugo;
+using json = nlohmann::json;
+using test::runUntil;
+
+namespace {
+
+// Publishes per round, the server pushes a marker publication once it has replied to a round
+constexpr auto BATCH = 512;
+constexpr auto WARM_UP_ROUNDS = 3;
+// Longer than std::string keeps inline, a copy of one would allocate
+auto const CHANNEL = std::string {"scoreboard:pinball-machine-1042"};
+auto const SERVER_CHANNEL = std::string {"scoreboard:pinball-machine-2048"};
+
+thread_local bool counting = false;
+thread_local std::size_t allocations = 0;
+
+}
+
+auto operator new(std::size_t size) -> void *
+{
+    if (counting) {
+        ++allocations;
+    }
+    if (auto *ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc {};
+}
+
+auto operator delete(void *ptr) noexcept -> void
+{
+    std::free(ptr);
+}
+
+auto operator delete(void *ptr, std::size_t) noexcept -> void
+{
+    std::free(ptr);
+}
+
+namespace {
+
+auto payload() -> json
+{
+    return {{"game", "pinball"},
+            {"machine", 1042},
+            {"scores", {1250000, 830000, 4125000, 0}},
+            {"player", 3},
+            {"ball", 2},
+            {"active", true}};
+}
+
+}
+
+int main()
+{
+    auto server = test::StubServer {CHANNEL, SERVER_CHANNEL, BATCH};
+    auto io = net::io_context {};
+    auto const strand = net::make_strand(io);
+    auto config = ClientConfig {};
+    config.getToken = [] { return outcome::result<std::string> {"token"}; };
+    auto client = Client {strand, server.url(), std::move(config)};
+
+    auto failed = false;
+    client.onError([&failed](Error const &error) {
+        std::printf("error: %s\n", error.message.c_str());
+        failed = true;
+    });
+    auto subscribed = std::size_t {0};
+    client.onSubscribed([&subscribed](std::string const &) { ++subscribed; });
+
+    auto &sub = client.newSubscription(CHANNEL).value().get();
+    auto rounds = 0;
+    sub.onPublication([&rounds](Publication const &) { ++rounds; });
+    sub.onSubscribed([&subscribed] { ++subscribed; });
+    if (!sub.subscribe() || !client.connect()
+        || !runUntil(io, [&] { return subscribed == 2; })) {
+        std::printf("could not subscribe\n");
+        return 1;
+    }
+
+    auto const data = payload();
+    auto const raw = RawJson {data.dump()};
+
+    // Allocations of the last round, after the earlier ones warmed the client up
+    auto measure = [&](char const *name, std::function<bool()> const &publish) {
+        auto count = std::size_t {0};
+        for (auto round = 0; round <= WARM_UP_ROUNDS; ++round) {
+            auto const marker = rounds + 1;
+            // Publishes run on the strand of the client, like its callbacks do
+            net::post(strand, [&] {
+                allocations = 0;
+                counting = true;
+                for (auto i = 0; i < BATCH; ++i) {
+                    failed = !publish() || failed;
+                }
+                counting = false;
+                count = allocations;
+            });
+            if (!runUntil(io, [&] { return rounds == marker; })) {
+                std::printf("%s: replies didn't arrive\n", name);
+                failed = true;
+            }
+        }
+
+        std::printf("%-20s %6zu allocations in %d publishes\n", name, count, BATCH);
+        failed = count > 0 || failed;
+    };
+
+    measure("subscription raw", [&] { return bool {sub.publish(raw)}; });
+    measure("client raw", [&] { return bool {client.publish(SERVER_CHANNEL, raw)}; });
+    measure("subscription json", [&] { return bool {sub.publish(data)}; });
+    measure("client json", [&] { return bool {client.publish(SERVER_CHANNEL, data)}; });
+
+    client.disconnect();
+    runUntil(io, [&] { return client.state() == ConnectionState::Disconnected; });
+    io.run_for(std::chrono::milliseconds {10});
+    return failed ? 1 : 0;
+}
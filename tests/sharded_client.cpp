@@ -0,0 +1,93 @@
+// Checks how ShardedClient assigns channels to shards: the same on every run and platform, even
+// enough across shards, and mostly kept when a shard is added. No server is needed, the shards
+// never connect.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <centrifugo/sharded_client.h>
+
+using namespace centrifugo;
+
+namespace {
+
+constexpr auto CHANNELS = 4000;
+constexpr auto URL = "ws://127.0.0.1:1/connection";
+
+auto failed = false;
+
+auto check(bool ok, char const *what) -> void
+{
+    if (!ok) {
+        std::printf("failed: %s\n", what);
+        failed = true;
+    }
+}
+
+auto channels() -> std::vector<std::string>
+{
+    auto names = std::vector<std::string> {};
+    for (auto i = 0; i < CHANNELS; ++i) {
+        names.push_back("scoreboard:pinball-machine-" + std::to_string(i));
+    }
+    return names;
+}
+
+auto sharding(std::size_t shards) -> ShardingConfig
+{
+    auto config = ShardingConfig {};
+    config.shards = shards;
+    return config;
+}
+
+}
+
+int main()
+{
+    auto const names = channels();
+    auto const four = ShardedClient {URL, {}, sharding(4)};
+    auto const again = ShardedClient {URL, {}, sharding(4)};
+    auto const five = ShardedClient {URL, {}, sharding(5)};
+
+    // Pinned, a change of the hash reshuffles the channels of every deployment
+    check(four.shard("news") == 1 && four.shard("chat:lobby") == 1
+                  && four.shard("scoreboard:pinball-machine-1042") == 3,
+          "assignments changed");
+
+    auto counts = std::vector<std::size_t>(four.shards());
+    auto moved = std::size_t {0};
+    for (auto const &name : names) {
+        auto const shard = four.shard(name);
+        check(shard < four.shards(), "shard out of range");
+        check(again.shard(name) == shard, "assignment differs between clients");
+        ++counts[shard];
+
+        // Adding a shard only takes channels over, none move between the others
+        if (auto const grown = five.shard(name); grown != shard) {
+            check(grown == 4, "channel moved between existing shards");
+            ++moved;
+        }
+    }
+
+    for (auto i = std::size_t {0}; i < counts.size(); ++i) {
+        std::printf("shard %zu: %zu channels\n", i, counts[i]);
+        check(counts[i] > CHANNELS / 4 / 2 && counts[i] < CHANNELS / 4 * 3 / 2, "uneven spread");
+    }
+    std::printf("%zu of %d channels moved to a fifth shard\n", moved, CHANNELS);
+    check(moved > CHANNELS / 5 / 2 && moved < CHANNELS / 5 * 2, "too many or few channels moved");
+
+    // Results come back in the order of the channels, whatever shard they went to
+    auto client = ShardedClient {URL, {}, sharding(4)};
+    auto const subs = client.subscribeMany({names[0], names[1], names[2], names[3], names[0]});
+    check(subs.size() == 5, "subscribeMany() lost results");
+    for (auto i = std::size_t {0}; i < 4 && i < subs.size(); ++i) {
+        check(subs[i] && subs[i].value().get().channel() == names[i], "results out of order");
+    }
+    check(subs.size() == 5 && !subs[4], "duplicate subscription accepted");
+    check(client.subscriptions().size() == 4, "subscriptions() misses some");
+    client.removeSubscription(names[0]);
+    check(!client.subscription(names[0]), "removeSubscription() by channel kept it");
+
+    return failed ? 1 : 0;
+}
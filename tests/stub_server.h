@@ -0,0 +1,127 @@
+#pragma once
+
+// A local stand-in for Centrifugo which tests connect to
+
+#include <chrono>
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+#include <nlohmann/json.hpp>
+
+namespace centrifugo::test {
+
+// Replies to connect, subscribe and publish commands, one frame of replies per frame of
+// commands. The connect reply subscribes the client to serverChannel server-side. Once it has
+// replied to every batch publishes, a marker publication is pushed to channel.
+class StubServer
+{
+public:
+    StubServer(std::string channel, std::string serverChannel, std::size_t batch)
+        : channel_ {std::move(channel)}
+        , serverChannel_ {std::move(serverChannel)}
+        , batch_ {batch}
+        , acceptor_ {io_, {boost::asio::ip::make_address("127.0.0.1"), 0}}
+        , thread_ {[this] { run(); }}
+    {
+    }
+
+    ~StubServer() { thread_.join(); }
+
+    auto port() const -> unsigned short { return acceptor_.local_endpoint().port(); }
+    auto url() const -> std::string
+    {
+        return "ws://127.0.0.1:" + std::to_string(port()) + "/connection";
+    }
+
+private:
+    using json = nlohmann::json;
+
+    auto run() -> void
+    {
+        namespace beast = boost::beast;
+
+        // A client which never connects mustn't keep the test waiting
+        auto socket = boost::asio::ip::tcp::socket {io_};
+        acceptor_.async_accept(socket, [](beast::error_code) {});
+        io_.run_for(std::chrono::seconds {10});
+        if (!socket.is_open()) {
+            return;
+        }
+
+        auto ws = beast::websocket::stream<boost::asio::ip::tcp::socket> {std::move(socket)};
+        ws.accept();
+
+        auto buffer = beast::flat_buffer {};
+        auto publishes = std::size_t {0};
+        for (;;) {
+            auto ec = beast::error_code {};
+            ws.read(buffer, ec);
+            if (ec) {
+                return;
+            }
+
+            auto commands = std::istringstream {beast::buffers_to_string(buffer.data())};
+            buffer.consume(buffer.size());
+            auto replies = std::string {};
+            for (auto line = std::string {}; std::getline(commands, line);) {
+                if (line.empty()) {
+                    continue;
+                }
+                auto const command = json::parse(line);
+                auto reply = json {{"id", command["id"]}};
+                if (command.contains("connect")) {
+                    reply["connect"] = {{"client", "test"},
+                                        {"version", "0.0.0"},
+                                        {"subs", {{serverChannel_, json::object()}}}};
+                } else if (command.contains("subscribe")) {
+                    reply["subscribe"] = json::object();
+                } else if (command.contains("publish")) {
+                    reply["publish"] = json::object();
+                    ++publishes;
+                } else {
+                    continue;
+                }
+                replies += reply.dump() + '\n';
+                if (command.contains("publish") && publishes % batch_ == 0) {
+                    auto const marker = json {
+                            {"push", {{"channel", channel_}, {"pub", {{"data", publishes}}}}}};
+                    replies += marker.dump() + '\n';
+                }
+            }
+            if (!replies.empty()) {
+                replies.pop_back();
+                ws.write(boost::asio::buffer(replies));
+            }
+        }
+    }
+
+    std::string channel_;
+    std::string serverChannel_;
+    std::size_t batch_;
+    boost::asio::io_context io_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    std::thread thread_;
+};
+
+// Runs io until done() holds, false if it didn't within 10 seconds
+template<typename Predicate>
+auto runUntil(boost::asio::io_context &io, Predicate &&done) -> bool
+{
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds {10};
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        io.run_for(std::chrono::milliseconds {1});
+    }
+    return true;
+}
+
+}
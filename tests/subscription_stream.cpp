@@ -0,0 +1,163 @@
+// Feeds publications with chosen offsets to a positioned subscription: duplicates are dropped,
+// a gap subscribes again and is filled by recovery, or reported when it can't be. The transport
+// never connects, subscribe replies are handed to the subscription directly.
+
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/strand.hpp>
+
+#include "subscription_impl.h"
+
+using namespace centrifugo;
+
+namespace {
+
+auto const CHANNEL = std::string {"scoreboard:pinball-machine-1042"};
+
+auto failed = false;
+
+auto check(bool ok, char const *what) -> void
+{
+    if (!ok) {
+        std::printf("failed: %s\n", what);
+        failed = true;
+    }
+}
+
+auto publication(std::uint64_t offset) -> Publication
+{
+    auto pub = Publication {};
+    pub.offset = offset;
+    pub.data = offset;
+    return pub;
+}
+
+auto subscribed(std::uint64_t offset, bool recoverable) -> SubscribeResult
+{
+    auto result = SubscribeResult {};
+    result.recoverable = recoverable;
+    result.positioned = true;
+    result.epoch = "epoch";
+    result.offset = offset;
+    return result;
+}
+
+// A subscription with everything it is wired to in a client
+class Stream
+{
+public:
+    Stream()
+        : strand_ {net::make_strand(io_)}
+        , transport_ {strand_, "ws://127.0.0.1:1/connection", ClientConfig {}}
+        , scheduler_ {strand_, {}, [this](std::string const &) { ++resubscribes; }}
+        , delivery_ {strand_, 0,
+                     [this](std::string const &, Publication const &pub) { handle(pub); }}
+        , sub_ {std::in_place, CHANNEL, transport_, scheduler_, delivery_, routes_}
+    {
+        sub_->onPublication().connect([this](Publication const &pub) {
+            delivered.push_back(pub.offset);
+        });
+        sub_->onError().connect([this](Error const &error) { errors.push_back(error); });
+        check(bool {sub_->subscribe()}, "subscribe() failed");
+    }
+
+    auto reply(SubscribeResult const &result) -> void { sub_->handleReply({1, result}); }
+    auto handle(Publication const &pub) -> void { sub_->handlePublish(pub); }
+    auto state() const -> SubscriptionState { return sub_->state(); }
+
+    std::vector<std::uint64_t> delivered;
+    std::vector<Error> errors;
+    int resubscribes {0};
+
+private:
+    net::io_context io_;
+    net::strand<net::io_context::executor_type> strand_;
+    Transport transport_;
+    SubscribeScheduler scheduler_;
+    DeliveryQueue delivery_;
+    ReplyRoutes routes_;
+    std::optional<SubscriptionImpl> sub_;
+};
+
+auto offsets(std::initializer_list<std::uint64_t> list) -> std::vector<std::uint64_t>
+{
+    return list;
+}
+
+auto recoverable() -> void
+{
+    auto stream = Stream {};
+    stream.reply(subscribed(10, true));
+    check(stream.state() == SubscriptionState::SUBSCRIBED, "not subscribed");
+
+    for (auto const offset : {11, 12, 12, 5, 13}) {
+        stream.handle(publication(offset));
+    }
+    check(stream.delivered == offsets({11, 12, 13}), "duplicates delivered");
+    check(stream.resubscribes == 0, "subscribed again without a gap");
+
+    // 14 went missing, the subscription recovers from 13
+    stream.handle(publication(15));
+    check(stream.resubscribes == 1 && stream.state() == SubscriptionState::SUBSCRIBING,
+          "gap didn't subscribe again");
+    check(stream.errors.empty(), "recoverable gap reported");
+    stream.handle(publication(16));
+    check(stream.delivered.size() == 3, "delivered while subscribing again");
+
+    auto recovered = subscribed(16, true);
+    recovered.was_recovering = true;
+    recovered.recovered = true;
+    recovered.publications = {publication(14), publication(15), publication(16)};
+    stream.reply(recovered);
+    stream.handle(publication(16));
+    stream.handle(publication(17));
+    check(stream.delivered == offsets({11, 12, 13, 14, 15, 16, 17}), "gap not filled in order");
+}
+
+auto unrecoverable() -> void
+{
+    auto stream = Stream {};
+    stream.reply(subscribed(10, false));
+    stream.handle(publication(11));
+    stream.handle(publication(13));
+    check(stream.resubscribes == 1, "gap didn't subscribe again");
+    check(stream.errors.size() == 1 && stream.errors[0].ec == ErrorType::PublicationsLost,
+          "gap not reported");
+
+    // Recovery came too late, what came back starts the stream over
+    auto lost = subscribed(0, true);
+    lost.was_recovering = true;
+    lost.publications = {publication(20), publication(21)};
+    stream.reply(lost);
+    check(stream.errors.size() == 2 && stream.errors[1].ec == ErrorType::PublicationsLost,
+          "failed recovery not reported");
+    stream.handle(publication(22));
+    check(stream.delivered == offsets({11, 20, 21, 22}), "stream not started over");
+    check(stream.resubscribes == 1, "subscribed again after starting over");
+}
+
+auto unpositioned() -> void
+{
+    auto stream = Stream {};
+    stream.reply(SubscribeResult {});
+    for (auto const offset : {0, 0, 7, 3}) {
+        stream.handle(publication(offset));
+    }
+    check(stream.delivered == offsets({0, 0, 7, 3}), "unpositioned stream filtered");
+    check(stream.resubscribes == 0 && stream.errors.empty(), "unpositioned stream checked");
+}
+
+}
+
+int main()
+{
+    recoverable();
+    unrecoverable();
+    unpositioned();
+    return failed ? 1 : 0;
+}
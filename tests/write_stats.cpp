@@ -0,0 +1,88 @@
+// Publishes a round through Client to a local stand-in for Centrifugo and checks what
+// Client::writeStats() counted: frames, coalesced messages and the queue delays of both lanes.
+
+#include <cstdio>
+#include <string>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/strand.hpp>
+#include <nlohmann/json.hpp>
+
+#include <centrifugo.h>
+#include "stub_server.h"
+
+using namespace centrifugo;
+using test::runUntil;
+
+namespace {
+
+constexpr auto BATCH = 256;
+auto const CHANNEL = std::string {"scoreboard:pinball-machine-1042"};
+
+auto failed = false;
+
+auto check(bool ok, char const *what) -> void
+{
+    if (!ok) {
+        std::printf("failed: %s\n", what);
+        failed = true;
+    }
+}
+
+}
+
+int main()
+{
+    auto server = test::StubServer {CHANNEL, "scoreboard:pinball-machine-2048", BATCH};
+    auto io = net::io_context {};
+    auto const strand = net::make_strand(io);
+    auto config = ClientConfig {};
+    config.getToken = [] { return outcome::result<std::string> {"token"}; };
+    auto client = Client {strand, server.url(), std::move(config)};
+
+    client.onError([](Error const &error) { check(false, error.message.c_str()); });
+    auto &sub = client.newSubscription(CHANNEL).value().get();
+    auto subscribed = false;
+    auto markers = 0;
+    sub.onSubscribed([&subscribed] { subscribed = true; });
+    sub.onPublication([&markers](Publication const &) { ++markers; });
+
+    check(client.writeStats().frames == 0, "frames counted before connecting");
+    if (!sub.subscribe() || !client.connect() || !runUntil(io, [&] { return subscribed; })) {
+        std::printf("could not subscribe\n");
+        return 1;
+    }
+
+    // Queued at once on the strand, so the write path has them to coalesce
+    auto const data = nlohmann::json {{"game", "pinball"}, {"machine", 1042}};
+    net::post(strand, [&] {
+        for (auto i = 0; i < BATCH; ++i) {
+            check(bool {sub.publish(data)}, "publish failed");
+        }
+    });
+    check(runUntil(io, [&] { return markers == 1; }), "replies didn't arrive");
+
+    auto const stats = client.writeStats();
+    std::printf("%llu messages in %llu frames\n",
+                static_cast<unsigned long long>(stats.messages),
+                static_cast<unsigned long long>(stats.frames));
+    std::printf("data: %llu messages, %lld ns max, %lld ns total\n",
+                static_cast<unsigned long long>(stats.data.messages),
+                static_cast<long long>(stats.data.max.count()),
+                static_cast<long long>(stats.data.total.count()));
+
+    check(stats.frames > 0 && stats.frames < stats.messages, "publishes weren't coalesced");
+    check(stats.messages >= BATCH + 2, "messages missing");
+    check(stats.lastFrameMessages > 0, "last frame not counted");
+    // Connect and subscribe went over the control lane, publishes over the data lane
+    check(stats.control.messages >= 2, "control lane not counted");
+    check(stats.data.messages == BATCH, "data lane miscounted");
+    check(stats.data.max.count() > 0 && stats.data.total >= stats.data.max,
+          "queue delays not measured");
+
+    client.disconnect();
+    runUntil(io, [&] { return client.state() == ConnectionState::Disconnected; });
+    io.run_for(std::chrono::milliseconds {10});
+    return failed ? 1 : 0;
+}